@@ -24,6 +24,7 @@
 ****************************************************************************/
 
 #include "application.h"
+#include <consolewriter.h>
 #include <iocompletionport.h>
 
 #include <QtCore/QDebug>
@@ -47,6 +48,7 @@ Application::Application(int &argc, char **argv)
 Application::~Application()
 {
     IoCompletionPort::destroyInstance();
+    ConsoleWriter::destroyInstance();
 }
 
 void Application::exit(int exitCode)
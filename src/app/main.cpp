@@ -24,6 +24,7 @@
 ****************************************************************************/
 
 #include "application.h"
+#include <consolewriter.h>
 #include <helperfunctions.h>
 #include <jobserver.h>
 #include <options.h>
@@ -75,9 +76,21 @@ static void showUsage()
            "/X <filename> write stderr to file.\n"
            "/Y disable batch mode inference rules\n\n"
            "jom only options:\n"
+           "/BATCHWINDOW <ms> wait up to ms milliseconds for more targets of batch-mode rules\n"
            "/DUMPGRAPH show the generated dependency graph\n"
            "/DUMPGRAPHDOT dump dependency graph in dot format\n"
+           "/GLOBALGRAPH merge the makefiles of recursive jom calls into one dependency graph\n"
+           "/INPROCESSMAKE run recursive jom calls inside this jom process\n"
            "/J <n> use up to n processes in parallel\n"
+           "/LINEOUTPUT print every output line immediately, prefixed with the target name\n"
+           "/LOGDIR <directory> write the output of every target to a log file in directory\n"
+           "/MAXCMDLINE <n> move the arguments of command lines longer than n characters\n"
+           "               into response files (default: 0, no response files)\n"
+           "/ORDEREDOUTPUT print the output of all targets in a fixed order\n"
+           "/OUTPUTBUFFERLIMIT <n> buffer up to n MB output per job in memory (default: 64)\n"
+           "/PARSECACHE <directory> store parsed makefiles in directory and reuse them\n"
+           "               if the makefiles did not change\n"
+           "/RESOURCEREPORT <filename> write resource usage per target to file\n"
            "/VERSION print version and exit\n");
 }
 
@@ -183,6 +196,10 @@ int main(int argc, char* argv[])
         if (options->showLogo && !app.isSubJOM())
             showLogo();
 
+        if (options->debugMode && mf.makefileLoadedFromCache())
+            fprintf(stderr, "jom: %s was loaded from the parse cache\n",
+                    qPrintable(mf.makefile()->fileName()));
+
         QScopedPointer<Makefile> mkfile(mf.makefile());
         if (options->displayMakeInformation) {
             printf("MACROS:\n\n");
@@ -218,6 +235,14 @@ int main(int argc, char* argv[])
         QMetaObject::invokeMethod(&executor, "startProcesses", Qt::QueuedConnection);
         result = app.exec();
         g_pTargetExecutor = 0;
+        ConsoleWriter::instance()->flush();
+        if (options->debugMode) {
+            const ConsoleWriter::Statistics stats = ConsoleWriter::instance()->statistics();
+            fprintf(stderr, "jom: console output: %llu bytes in %llu batches, peak queue size %lld bytes\n"
+                    "jom: console output blocked %llu times for %lld ms\n",
+                    stats.bytesWritten, stats.batchCount, stats.peakQueueSize,
+                    stats.blockedCount, stats.blockedTime);
+        }
         if (options->printWorkingDir) {
             printf("jom: Leaving directory '%s'\n",
                    qPrintable(QDir::toNativeSeparators(QDir::currentPath())));
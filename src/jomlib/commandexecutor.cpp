@@ -24,31 +24,33 @@
 ****************************************************************************/
 
 #include "commandexecutor.h"
+#include "consolewriter.h"
 #include "options.h"
 #include "exception.h"
 #include "helperfunctions.h"
 #include "fastfileinfo.h"
+#include "nestedbuild.h"
 
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
-#include <QtCore/QRegExp>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
 #include <QStringList>
 #include <windows.h>
 
 namespace NMakeFile {
 
-ulong CommandExecutor::m_startUpTickCount = 0;
 QString CommandExecutor::m_tempPath;
 
-CommandExecutor::CommandExecutor(QObject* parent, const ProcessEnvironment &environment)
+CommandExecutor::CommandExecutor(QObject* parent, SharedProcessEnvironment *environment)
 :   QObject(parent),
+    m_environment(environment),
+    m_nestedBuild(0),
     m_pTarget(0),
+    m_processCount(0),
     m_ignoreProcessErrors(false),
     m_active(false)
 {
-    if (m_startUpTickCount == 0)
-        m_startUpTickCount = GetTickCount();
-
     if (m_tempPath.isNull()) {
         WCHAR buf[MAX_PATH];
         DWORD count = GetTempPathW(MAX_PATH, buf);
@@ -60,6 +62,7 @@ CommandExecutor::CommandExecutor(QObject* parent, const ProcessEnvironment &envi
 
     m_process.setEnvironment(environment);
     connect(&m_process, SIGNAL(error(Process::ProcessError)), SLOT(onProcessError(Process::ProcessError)));
+    connect(&m_process, SIGNAL(finished(int, Process::ExitStatus)), SLOT(addProcessResourceUsage()));
     connect(&m_process, SIGNAL(finished(int, Process::ExitStatus)), SLOT(onProcessFinished(int, Process::ExitStatus)));
 }
 
@@ -72,6 +75,10 @@ void CommandExecutor::start(DescriptionBlock* target)
 {
     m_pTarget = target;
     m_active = true;
+    m_resourceUsage = ProcessResourceUsage();
+    m_processCount = 0;
+    if (m_process.isLineOutputSet())
+        m_process.setOutputLinePrefix('[' + target->targetName().toLocal8Bit() + "] ");
 
     if (target->m_commands.isEmpty()) {
         finishExecution(false);
@@ -80,7 +87,6 @@ void CommandExecutor::start(DescriptionBlock* target)
 
     target->expandFileNameMacros();
     cleanupTempFiles();
-    createTempFiles();
 
     m_ignoreProcessErrors = false;
     m_currentCommandIdx = 0;
@@ -124,15 +130,87 @@ void CommandExecutor::onProcessFinished(int exitCode, Process::ExitStatus exitSt
     }
 }
 
+void CommandExecutor::addProcessResourceUsage()
+{
+    m_resourceUsage += m_process.resourceUsage();
+    ++m_processCount;
+}
+
 void CommandExecutor::finishExecution(bool commandFailed)
 {
+    if (!m_logDirectory.isEmpty() && !m_pTarget->m_commands.isEmpty())
+        writeLogFile(commandFailed);
+    cleanupTempFiles();
     m_active = false;
     emit finished(this, commandFailed);
 }
 
+/**
+ * If a log directory is set, the echoed commands and the output of all commands
+ * of a target are captured and written to a log file in that directory.
+ * Nothing is printed to the console, unless the target fails.
+ */
+void CommandExecutor::setLogDirectory(const QString &directory)
+{
+    m_logDirectory = directory;
+    m_process.setOutputCapture(!m_logDirectory.isEmpty());
+}
+
+typedef QHash<QString, QString> LogFileOwners;
+Q_GLOBAL_STATIC(LogFileOwners, logFileOwners)
+
+/**
+ * Returns the log file name for a target.
+ * Different targets whose names map to the same file name, e.g. a/b.obj and a_b.obj,
+ * get a numbered suffix. The first one to be logged keeps the plain name.
+ */
+static QString logFileName(const QString &directory, DescriptionBlock *target)
+{
+    QString baseName = target->targetName();
+    const QString invalidChars = QLatin1String("\\/:*?\"<>|");
+    for (int i = 0; i < baseName.length(); ++i) {
+        if (baseName.at(i).unicode() < 32 || invalidChars.contains(baseName.at(i)))
+            baseName[i] = QLatin1Char('_');
+    }
+    baseName = directory + QLatin1Char('/') + baseName;
+
+    const QString owner = (target->makefile()->fileName() + QLatin1Char('|')
+                           + target->targetName()).toLower();
+    LogFileOwners *owners = logFileOwners();
+    QString fileName = baseName + QLatin1String(".log");
+    for (int i = 2;; ++i) {
+        LogFileOwners::iterator it = owners->find(fileName.toLower());
+        if (it == owners->end()) {
+            owners->insert(fileName.toLower(), owner);
+            break;
+        }
+        if (it.value() == owner)
+            break;
+        fileName = baseName + QLatin1Char('.') + QString::number(i) + QLatin1String(".log");
+    }
+    return fileName;
+}
+
+void CommandExecutor::writeLogFile(bool commandFailed)
+{
+    const QString fileName = logFileName(m_logDirectory, m_pTarget);
+
+    QFile logFile(fileName);
+    if (!logFile.open(QFile::WriteOnly | QFile::Truncate)) {
+        writeToStandardError("jom: cannot open log file "
+                             + QDir::toNativeSeparators(fileName).toLocal8Bit() + '\n');
+        m_process.flushBufferedOutput(0, true);
+        return;
+    }
+    m_process.flushBufferedOutput(&logFile, commandFailed);
+}
+
 void CommandExecutor::waitForFinished()
 {
-    m_process.waitForFinished();
+    if (m_nestedBuild)
+        m_nestedBuild->waitForFinished();
+    else
+        m_process.waitForFinished();
 }
 
 inline bool commandLineStartsWithCommand(const QString &str, const QString &searchString)
@@ -144,16 +222,57 @@ inline bool commandLineStartsWithCommand(const QString &str, const QString &sear
 
 static bool startsWithShellBuiltin(const QString &commandLine)
 {
-    static QRegExp rex(QLatin1String(
-        "^(assoc|break|call|chdir|cd|cls|color|copy|del|dir|echo|endlocal|erase|exit|for|ftype|goto"
-        "|if|md|move|path|pause|popd|prompt|pushd|ren|rename|setlocal|shift|time|title|type|ver|verify|vol)\\s"
-        ), Qt::CaseInsensitive, QRegExp::RegExp2);
-    return rex.indexIn(commandLine) >= 0;
+    static const char * const builtins[] = {
+        "assoc", "break", "call", "cd", "chdir", "cls", "color", "copy", "del", "dir", "echo",
+        "endlocal", "erase", "exit", "for", "ftype", "goto", "if", "md", "move", "path", "pause",
+        "popd", "prompt", "pushd", "ren", "rename", "setlocal", "shift", "time", "title", "type",
+        "ver", "verify", "vol"
+    };
+
+    // The builtin is the part of the command line before the first white space.
+    int length = 0;
+    while (length < commandLine.length() && !commandLine.at(length).isSpace())
+        ++length;
+    if (length == commandLine.length())
+        return false;
+
+    const QStringRef command = commandLine.leftRef(length);
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+        if (command.compare(QLatin1String(builtins[i]), Qt::CaseInsensitive) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool isShellComment(const QString &commandLine)
+{
+    return commandLine.startsWith(QLatin1Char(':'))
+        || (commandLine.length() > 3 && commandLine.at(3).isSpace()
+            && commandLine.startsWith(QLatin1String("rem"), Qt::CaseInsensitive));
 }
 
+/**
+ * Starts the current command. If the command cannot be started at all, the
+ * error signal is emitted instead of the finished signal.
+ */
 void CommandExecutor::executeCurrentCommandLine()
 {
-    const Command& cmd = m_pTarget->m_commands.at(m_currentCommandIdx);
+    try {
+        startCurrentCommandLine();
+    } catch (const Exception &e) {
+        m_ignoreProcessErrors = false;
+        m_active = false;
+        emit error(this, e.message());
+    }
+}
+
+void CommandExecutor::startCurrentCommandLine()
+{
+    Command& cmd = m_pTarget->m_commands[m_currentCommandIdx];
+    if (!createTempFiles(cmd)) {
+        finishExecution(true);
+        return;
+    }
     QString commandLine = cmd.m_commandLine;
 
     if (m_pTarget->makefile()->options()->dryRun
@@ -168,14 +287,19 @@ void CommandExecutor::executeCurrentCommandLine()
     // Unescape commandline characters.
     commandLine.replace(QLatin1String("%%"), QLatin1String("%"));
 
-    static QRegExp rexShellComment(QLatin1String("^(:|rem\\s)"),
-                                   Qt::CaseInsensitive, QRegExp::RegExp2);
-    if (m_pTarget->makefile()->options()->dryRun || (rexShellComment.indexIn(commandLine) >= 0))
+    if (m_pTarget->makefile()->options()->dryRun || isShellComment(commandLine))
     {
         onProcessFinished(0, Process::NormalExit);
         return;
     }
 
+    const int maxCommandLineLength = m_pTarget->makefile()->options()->maxCommandLineLength;
+    if (maxCommandLineLength > 0 && commandLine.length() > maxCommandLineLength
+            && !moveArgumentsToResponseFile(commandLine)) {
+        finishExecution(true);
+        return;
+    }
+
     if (!m_nextWorkingDir.isEmpty()) {
         m_process.setWorkingDirectory(m_nextWorkingDir);
         m_nextWorkingDir.clear();
@@ -196,10 +320,7 @@ void CommandExecutor::executeCurrentCommandLine()
             if (idx >= 0) {
                 QString variableName = variableAssignment.left(idx);
                 QString variableValue = variableAssignment.mid(idx + 1);
-                ProcessEnvironment environment = m_process.environment();
-                environment.insert(variableName, variableValue);
-                setEnvironment(environment);
-                emit environmentChanged(environment);
+                m_environment->publish(variableName, variableValue);
             }
         } else {
             builtInHandled = false;
@@ -210,6 +331,11 @@ void CommandExecutor::executeCurrentCommandLine()
         }
     }
 
+    if (simpleCmdLine && m_pTarget->makefile()->options()->inProcessMake
+            && startNestedBuild(commandLine)) {
+        return;
+    }
+
     bool executionSucceeded = false;
     if (simpleCmdLine && !startsWithShellBuiltin(commandLine)) {
         // ### It would be cool if we would not try to start every command directly.
@@ -246,84 +372,208 @@ void CommandExecutor::executeCurrentCommandLine()
             shellCmd = QLatin1String("cmd.exe");
 
         commandLine = shellCmd + QLatin1Literal(" /C ") + commandLine;
+        m_ignoreProcessErrors = true;
         m_process.start(commandLine);
         executionSucceeded = m_process.isRunning();
+        m_ignoreProcessErrors = false;
     }
 
-    if (!executionSucceeded)
-        qFatal("Can't start command: %s", qPrintable(commandLine));
+    if (!executionSucceeded) {
+        QString msg = QLatin1String("Can't start command: %1");
+        throw Exception(msg.arg(commandLine));
+    }
 }
 
-void CommandExecutor::createTempFiles()
+/**
+ * Runs a recursive jom call in this process, if the command line allows it.
+ * The nested build must run in jom's working directory, because file names
+ * are resolved relative to it.
+ * Returns false, if the command must be run in a separate process.
+ */
+bool CommandExecutor::startNestedBuild(const QString &commandLine)
 {
-    QList<Command>::iterator it = m_pTarget->m_commands.begin();
-    QList<Command>::iterator itEnd = m_pTarget->m_commands.end();
-    for (; it != itEnd; ++it) {
-        Command& cmd = *it;
-        foreach (InlineFile* inlineFile, cmd.m_inlineFiles) {
-            QString fileName;
-            if (inlineFile->m_filename.isEmpty()) {
-                do {
-                    QString simplifiedTargetName = m_pTarget->targetName();
-                    simplifiedTargetName = fileNameFromFilePath(simplifiedTargetName);
-                    fileName = m_tempPath + simplifiedTargetName + QLatin1Char('.')
-                               + QString::number(GetCurrentProcessId()) + QLatin1Char('.')
-                               + QString::number(GetTickCount() - m_startUpTickCount)
-                               + QLatin1Literal(".jom");
-                } while (QFile::exists(fileName));
-            } else
-                fileName = inlineFile->m_filename;
-
-            TempFile tempFile;
-            tempFile.keep = inlineFile->m_keep;
-            tempFile.file = new QFile(fileName);
-            if (!tempFile.file->open(QFile::WriteOnly)) {
-                delete tempFile.file;
-                QString msg = QLatin1String("cannot open %1 for write");
-                throw Exception(msg.arg(fileName));
-            }
+    const QString workingDirectory = m_process.workingDirectory();
+    if (!workingDirectory.isEmpty() && QDir(workingDirectory) != QDir::current())
+        return false;
 
-            const QByteArray content = inlineFile->m_content.toLocal8Bit();
-            if (m_pTarget->makefile()->options()->dumpInlineFiles) {
-                writeToStandardOutput("---");
-                writeToStandardOutput(fileName.toLocal8Bit());
-                writeToStandardOutput("---\n");
-                writeToStandardOutput(content);
-                writeToStandardOutput("---end of inline file---\n");
-            }
+    QStringList arguments;
+    if (!NestedBuild::parseCommandLine(commandLine, m_pTarget->makefile()->options(),
+                                       m_environment->environment(), &arguments)) {
+        return false;
+    }
+
+    m_nestedBuild = new NestedBuild(this);
+    connect(m_nestedBuild, &NestedBuild::standardOutput,
+            this, &CommandExecutor::writeToStandardOutput);
+    connect(m_nestedBuild, &NestedBuild::standardError,
+            this, &CommandExecutor::writeToStandardError);
+    connect(m_nestedBuild, &NestedBuild::finished,
+            this, &CommandExecutor::onNestedBuildFinished);
+    m_nestedBuild->start(arguments, m_environment->environment());
+    return true;
+}
 
-            // TODO: do something with inlineFile->m_unicode;
-            tempFile.file->write(content);
-            tempFile.file->close();
+void CommandExecutor::onNestedBuildFinished(int exitCode)
+{
+    // The nested build might still be on the call stack.
+    m_nestedBuild->deleteLater();
+    m_nestedBuild = 0;
+
+    // Print the buffered output like a finished process does.
+    if (!m_process.isOutputCaptureSet())
+        m_process.flushBufferedOutput(0, true);
+    onProcessFinished(exitCode, Process::NormalExit);
+}
 
-            QString replacement = QDir::toNativeSeparators(tempFile.file->fileName());
-            if (replacement.contains(QLatin1Char(' ')) || replacement.contains(QLatin1Char('\t'))) {
-                replacement.prepend(QLatin1Char('"'));
-                replacement.append(QLatin1Char('"'));
-            }
+static bool writeInlineFile(const QString &fileName, const QByteArray &content, bool temporary)
+{
+    // Files that are removed when the target has finished are marked as temporary.
+    // The system tries to keep those in the file cache instead of writing them to disk.
+    const DWORD dwFlagsAndAttributes = temporary
+            ? FILE_ATTRIBUTE_TEMPORARY : FILE_ATTRIBUTE_NORMAL;
+    HANDLE hFile = CreateFileW(reinterpret_cast<const wchar_t *>(fileName.utf16()),
+                               GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                               dwFlagsAndAttributes, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
 
-            int idx = cmd.m_commandLine.indexOf(QLatin1String("<<"));
-            if (idx > 0)
-                cmd.m_commandLine.replace(idx, 2, replacement);
+    DWORD bytesWritten = 0;
+    const BOOL success = WriteFile(hFile, content.constData(), content.size(), &bytesWritten, NULL);
+    CloseHandle(hFile);
+    return success && bytesWritten == DWORD(content.size());
+}
+
+/**
+ * Returns a unique file name in the temp directory.
+ * The process id and a counter make the name unique. No need to probe the file system.
+ */
+QString CommandExecutor::tempFileName(const QString &extension) const
+{
+    static uint tempFileCounter = 0;
+    return m_tempPath + fileNameFromFilePath(m_pTarget->targetName()) + QLatin1Char('.')
+            + QString::number(GetCurrentProcessId()) + QLatin1Char('.')
+            + QString::number(++tempFileCounter) + extension;
+}
+
+/**
+ * Writes the inline files of the command that is about to be executed and
+ * replaces the << markers in the command line with the file names.
+ * The files are removed when the target has finished, unless they are to be kept.
+ * Later commands of the same target can still read them.
+ */
+bool CommandExecutor::createTempFiles(Command &cmd)
+{
+    foreach (InlineFile* inlineFile, cmd.m_inlineFiles) {
+        QString fileName;
+        if (inlineFile->m_filename.isEmpty())
+            fileName = tempFileName(QLatin1String(".jom"));
+        else
+            fileName = inlineFile->m_filename;
+
+        const QByteArray content = inlineFile->m_content.toLocal8Bit();
+        if (m_pTarget->makefile()->options()->dumpInlineFiles) {
+            writeToStandardOutput("---");
+            writeToStandardOutput(fileName.toLocal8Bit());
+            writeToStandardOutput("---\n");
+            writeToStandardOutput(content);
+            writeToStandardOutput("---end of inline file---\n");
+        }
+
+        // TODO: do something with inlineFile->m_unicode;
+        const QString nativeFileName = QDir::toNativeSeparators(fileName);
+        if (!writeInlineFile(nativeFileName, content, !inlineFile->m_keep)) {
+            QString msg = QLatin1String("jom: cannot open %1 for write\n");
+            writeToStandardError(msg.arg(fileName).toLocal8Bit());
+            return false;
+        }
 
-            m_tempFiles.append(tempFile);
+        TempFile tempFile;
+        tempFile.fileName = fileName;
+        tempFile.keep = inlineFile->m_keep;
+        m_tempFiles.append(tempFile);
+
+        QString replacement = nativeFileName;
+        if (replacement.contains(QLatin1Char(' ')) || replacement.contains(QLatin1Char('\t'))) {
+            replacement.prepend(QLatin1Char('"'));
+            replacement.append(QLatin1Char('"'));
         }
+
+        int idx = cmd.m_commandLine.indexOf(QLatin1String("<<"));
+        if (idx > 0)
+            cmd.m_commandLine.replace(idx, 2, replacement);
+    }
+    return true;
+}
+
+/**
+ * Moves the arguments of a command line that is too long into a response file
+ * and replaces them with @responsefile.
+ *
+ * This is only done for tools that are known to accept response files or that
+ * are listed in the makefile's .RESPONSEFILES directive. Command lines that
+ * contain redirections or pipes are left alone.
+ * Returns false, if the response file cannot be written.
+ */
+bool CommandExecutor::moveArgumentsToResponseFile(QString &commandLine)
+{
+    if (!isSimpleCommandLine(commandLine))
+        return true;
+
+    // Split off the program, which may be enclosed in double quotes.
+    int idx;
+    QString program;
+    if (commandLine.startsWith(QLatin1Char('"'))) {
+        idx = commandLine.indexOf(QLatin1Char('"'), 1);
+        if (idx < 0)
+            return true;
+        program = commandLine.mid(1, idx - 1);
+        ++idx;
+    } else {
+        for (idx = 0; idx < commandLine.length() && !commandLine.at(idx).isSpace(); ++idx) {}
+        program = commandLine.left(idx);
+    }
+
+    const QString arguments = commandLine.mid(idx).trimmed();
+    if (arguments.isEmpty() || !m_pTarget->makefile()->acceptsResponseFile(program))
+        return true;
+
+    const QString fileName = tempFileName(QLatin1String(".rsp"));
+    const QString nativeFileName = QDir::toNativeSeparators(fileName);
+    if (!writeInlineFile(nativeFileName, arguments.toLocal8Bit(), true)) {
+        QString msg = QLatin1String("jom: cannot open %1 for write\n");
+        writeToStandardError(msg.arg(fileName).toLocal8Bit());
+        return false;
+    }
+
+    TempFile tempFile;
+    tempFile.fileName = fileName;
+    tempFile.keep = false;
+    m_tempFiles.append(tempFile);
+
+    QString responseFileArgument = QLatin1Char('@') + nativeFileName;
+    if (nativeFileName.contains(QLatin1Char(' ')) || nativeFileName.contains(QLatin1Char('\t'))) {
+        responseFileArgument.prepend(QLatin1Char('"'));
+        responseFileArgument.append(QLatin1Char('"'));
     }
+    commandLine.truncate(idx);
+    commandLine += QLatin1Char(' ') + responseFileArgument;
+    return true;
 }
 
 void CommandExecutor::cleanupTempFiles()
 {
+    if (m_nestedBuild)
+        m_nestedBuild->removeTempFiles();
     while (!m_tempFiles.isEmpty()) {
-        const TempFile& tempfile = m_tempFiles.takeLast();
-        if (!tempfile.keep) tempfile.file->remove();
-        delete tempfile.file;
+        const TempFile tempfile = m_tempFiles.takeLast();
+        if (!tempfile.keep)
+            QFile::remove(tempfile.fileName);
     }
 }
 
 void CommandExecutor::writeToChannel(const QByteArray& data, FILE *channel)
 {
-    fputs(data, channel);
-    fflush(channel);
+    ConsoleWriter::instance()->write(channel, data, ConsoleWriter::TextMode);
 }
 
 void CommandExecutor::writeToStandardOutput(const QByteArray& output)
@@ -344,8 +594,16 @@ void CommandExecutor::writeToStandardError(const QByteArray& output)
 
 bool CommandExecutor::isSimpleCommandLine(const QString &commandLine)
 {
-    static QRegExp rex(QLatin1String("\\||>|<|&"));
-    return rex.indexIn(commandLine) == -1;
+    for (int i = 0; i < commandLine.length(); ++i) {
+        switch (commandLine.at(i).unicode()) {
+        case '|':
+        case '>':
+        case '<':
+        case '&':
+            return false;
+        }
+    }
+    return true;
 }
 
 bool CommandExecutor::exec_cd(const QString &commandLine)
@@ -390,9 +648,4 @@ bool CommandExecutor::exec_cd(const QString &commandLine)
     return true;
 }
 
-void CommandExecutor::setEnvironment(const ProcessEnvironment &environment)
-{
-    m_process.setEnvironment(environment);
-}
-
 } // namespace NMakeFile
@@ -37,11 +37,13 @@ QT_END_NAMESPACE
 
 namespace NMakeFile {
 
+class NestedBuild;
+
 class CommandExecutor : public QObject
 {
     Q_OBJECT
 public:
-    CommandExecutor(QObject* parent, const ProcessEnvironment &environment);
+    CommandExecutor(QObject* parent, SharedProcessEnvironment *environment);
     ~CommandExecutor();
 
     void start(DescriptionBlock* target);
@@ -51,41 +53,56 @@ public:
     void cleanupTempFiles();
     void setBufferedOutput(bool b) { m_process.setBufferedOutput(b); }
     bool isBufferedOutputSet() const { return m_process.isBufferedOutputSet(); }
-
-public slots:
-    void setEnvironment(const ProcessEnvironment &environment);
+    void setLineOutput(bool b) { m_process.setLineOutput(b); }
+    void setOutputMemoryLimit(qint64 limit) { m_process.setOutputMemoryLimit(limit); }
+    void setLogDirectory(const QString &directory);
+    void setOutputCapture(bool b) { m_process.setOutputCapture(b); }
+    void takeCapturedOutput(OutputBuffer &output) { m_process.takeBufferedOutput(output); }
+    const ProcessResourceUsage &resourceUsage() const { return m_resourceUsage; }
+    int processCount() const { return m_processCount; }
+    static bool isSimpleCommandLine(const QString &cmdLine);
 
 signals:
-    void environmentChanged(const ProcessEnvironment &environment);
     void finished(CommandExecutor* process, bool abortMakeProcess);
+    void error(CommandExecutor* process, const QString &message);
 
 private slots:
     void onProcessError(Process::ProcessError error);
     void onProcessFinished(int exitCode, Process::ExitStatus exitStatus);
+    void addProcessResourceUsage();
+    void onNestedBuildFinished(int exitCode);
 
 private:
     void finishExecution(bool commandFailed);
+    void writeLogFile(bool commandFailed);
     void executeCurrentCommandLine();
-    void createTempFiles();
+    void startCurrentCommandLine();
+    bool createTempFiles(Command &cmd);
+    QString tempFileName(const QString &extension) const;
+    bool moveArgumentsToResponseFile(QString &commandLine);
     void writeToChannel(const QByteArray& data, FILE *channel);
     void writeToStandardOutput(const QByteArray& data);
     void writeToStandardError(const QByteArray& data);
-    bool isSimpleCommandLine(const QString &cmdLine);
+    bool startNestedBuild(const QString &commandLine);
     bool exec_cd(const QString &commandLine);
 
 private:
-    static ulong        m_startUpTickCount;
     static QString      m_tempPath;
+    SharedProcessEnvironment* m_environment;
     Process             m_process;
+    NestedBuild*        m_nestedBuild;
     DescriptionBlock*   m_pTarget;
 
     struct TempFile
     {
-        QFile* file;
-        bool   keep;
+        QString fileName;
+        bool    keep;
     };
 
     QList<TempFile>     m_tempFiles;
+    ProcessResourceUsage m_resourceUsage;
+    int                 m_processCount;
+    QString             m_logDirectory;
     int                 m_currentCommandIdx;
     QString             m_nextWorkingDir;
     bool                m_ignoreProcessErrors;
@@ -0,0 +1,246 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "consolewriter.h"
+
+#include <QtCore/QElapsedTimer>
+
+#include <errno.h>
+#ifdef Q_OS_WIN
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace NMakeFile {
+
+QAtomicPointer<ConsoleWriter> ConsoleWriter::m_instance;
+Q_GLOBAL_STATIC(QMutex, instanceMutex)
+
+ConsoleWriter::ConsoleWriter()
+    : m_queueSize(0)
+    , m_writing(false)
+    , m_quit(false)
+{
+    setObjectName(QLatin1String("console writer thread"));
+}
+
+ConsoleWriter::~ConsoleWriter()
+{
+    m_mutex.lock();
+    m_quit = true;
+    m_itemsAvailable.wakeOne();
+    m_mutex.unlock();
+    QThread::wait();
+}
+
+ConsoleWriter *ConsoleWriter::instance()
+{
+    ConsoleWriter *writer = m_instance.loadAcquire();
+    if (!writer) {
+        QMutexLocker locker(instanceMutex());
+        writer = m_instance.loadAcquire();
+        if (!writer) {
+            writer = new ConsoleWriter;
+            writer->start();
+            m_instance.storeRelease(writer);
+        }
+    }
+    return writer;
+}
+
+/**
+ * Writes all pending output and stops the writer thread.
+ */
+void ConsoleWriter::destroyInstance()
+{
+    QMutexLocker locker(instanceMutex());
+    delete m_instance.loadAcquire();
+    m_instance.storeRelease(0);
+}
+
+/**
+ * Queues data for writing to stream.
+ * Blocks if the queue is full.
+ */
+void ConsoleWriter::write(FILE *stream, const QByteArray &data, Mode mode)
+{
+    if (data.isEmpty())
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    waitUntilFits(data.size());
+    append(stream, data, mode);
+}
+
+/**
+ * Queues data for writing to stream, even if the queue is full.
+ * The caller should call waitForSpace() as soon as it doesn't hold any locks.
+ */
+void ConsoleWriter::enqueue(FILE *stream, const QByteArray &data, Mode mode)
+{
+    if (data.isEmpty())
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    append(stream, data, mode);
+}
+
+/**
+ * Blocks until the queue is not over its limit anymore.
+ */
+void ConsoleWriter::waitForSpace()
+{
+    QMutexLocker locker(&m_mutex);
+    waitUntilFits(0);
+}
+
+/**
+ * Blocks until size bytes fit into the queue. Must be called with m_mutex held.
+ */
+void ConsoleWriter::waitUntilFits(qint64 size)
+{
+    if (m_queueSize > 0 && m_queueSize + size > MaxQueueSize) {
+        QElapsedTimer timer;
+        timer.start();
+        ++m_statistics.blockedCount;
+        do {
+            m_spaceAvailable.wait(&m_mutex);
+        } while (m_queueSize > 0 && m_queueSize + size > MaxQueueSize);
+        m_statistics.blockedTime += timer.elapsed();
+    }
+}
+
+/**
+ * Must be called with m_mutex held.
+ */
+void ConsoleWriter::append(FILE *stream, const QByteArray &data, Mode mode)
+{
+    Item item;
+    item.stream = stream;
+    item.data = data;
+    item.mode = mode;
+    m_queue.append(item);
+    m_queueSize += data.size();
+    m_statistics.peakQueueSize = qMax(m_statistics.peakQueueSize, m_queueSize);
+    m_itemsAvailable.wakeOne();
+}
+
+/**
+ * Blocks until all queued output has been written.
+ */
+void ConsoleWriter::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    while (!m_queue.isEmpty() || m_writing)
+        m_drained.wait(&m_mutex);
+}
+
+ConsoleWriter::Statistics ConsoleWriter::statistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_statistics;
+}
+
+void ConsoleWriter::run()
+{
+    QList<Item> batch;
+    forever {
+        m_mutex.lock();
+        while (m_queue.isEmpty() && !m_quit)
+            m_itemsAvailable.wait(&m_mutex);
+        if (m_queue.isEmpty()) {
+            m_mutex.unlock();
+            return;
+        }
+        batch.swap(m_queue);
+        m_writing = true;
+        m_mutex.unlock();
+
+        const qint64 batchSize = writeBatch(batch);
+        batch.clear();
+
+        m_mutex.lock();
+        m_writing = false;
+        m_queueSize -= batchSize;
+        m_statistics.bytesWritten += batchSize;
+        ++m_statistics.batchCount;
+        m_spaceAvailable.wakeAll();
+        if (m_queue.isEmpty())
+            m_drained.wakeAll();
+        m_mutex.unlock();
+    }
+}
+
+static void fwrite_all(FILE *stream, const char *str, size_t count)
+{
+    if (fwrite(str, sizeof(char), count, stream)) {
+        // Write operation was successful.
+        return;
+    } else if (errno == ENOMEM) {
+        // The buffer was too big for writing. Write it in chunks.
+        const size_t chunkSize = 4096;
+        for (;;) {
+            size_t k = qMin(chunkSize, count);
+            fwrite(str, sizeof(char), k, stream);
+            fflush(stream);
+            if (k >= count)
+                break;
+            str += k;
+            count -= k;
+        }
+    }
+}
+
+/**
+ * Writes consecutive items for the same stream and mode in one go.
+ * The stream's mode is switched and the stream is flushed once per run of items.
+ */
+qint64 ConsoleWriter::writeBatch(const QList<Item> &batch)
+{
+    qint64 batchSize = 0;
+    QList<Item>::const_iterator it = batch.constBegin();
+    while (it != batch.constEnd()) {
+        FILE *stream = it->stream;
+        const Mode mode = it->mode;
+#ifdef Q_OS_WIN
+        const int fd = _fileno(stream);
+        const int origMode = (mode == BinaryMode) ? _setmode(fd, _O_BINARY) : -1;
+#endif
+        do {
+            fwrite_all(stream, it->data.constData(), it->data.size());
+            batchSize += it->data.size();
+            ++it;
+        } while (it != batch.constEnd() && it->stream == stream && it->mode == mode);
+        fflush(stream);
+#ifdef Q_OS_WIN
+        if (origMode != -1)
+            _setmode(fd, origMode);
+#endif
+    }
+    return batchSize;
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,120 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#ifndef CONSOLEWRITER_H
+#define CONSOLEWRITER_H
+
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+
+#include <cstdio>
+
+namespace NMakeFile {
+
+/**
+ * Writes all console output of jom in a dedicated thread.
+ *
+ * Writers put their data into a bounded queue. If the queue is full, because
+ * the console consumes the output slower than it is produced, the writers
+ * are blocked until the writer thread has made room. The time spent waiting
+ * is recorded in the statistics.
+ *
+ * Writers that hold locks other threads might wait for use enqueue(), which
+ * never blocks, and call waitForSpace() after releasing their locks. The queue
+ * can exceed its limit by the data they enqueue in between.
+ */
+class ConsoleWriter : protected QThread
+{
+public:
+    enum Mode
+    {
+        TextMode,
+        BinaryMode
+    };
+
+    enum { MaxQueueSize = 4 * 1024 * 1024 };   // in bytes
+
+    struct Statistics
+    {
+        Statistics()
+            : bytesWritten(0), batchCount(0), blockedCount(0),
+              blockedTime(0), peakQueueSize(0)
+        {
+        }
+
+        quint64 bytesWritten;
+        quint64 batchCount;
+        quint64 blockedCount;
+        qint64 blockedTime;     // in milliseconds
+        qint64 peakQueueSize;   // in bytes
+    };
+
+    static ConsoleWriter *instance();
+    static void destroyInstance();
+
+    void write(FILE *stream, const QByteArray &data, Mode mode = BinaryMode);
+    void enqueue(FILE *stream, const QByteArray &data, Mode mode = BinaryMode);
+    void waitForSpace();
+    void flush();
+    Statistics statistics() const;
+
+protected:
+    void run();
+
+private:
+    ConsoleWriter();
+    ~ConsoleWriter();
+
+    struct Item
+    {
+        FILE *stream;
+        QByteArray data;
+        Mode mode;
+    };
+
+    void waitUntilFits(qint64 size);
+    void append(FILE *stream, const QByteArray &data, Mode mode);
+    static qint64 writeBatch(const QList<Item> &batch);
+
+    static QAtomicPointer<ConsoleWriter> m_instance;
+    mutable QMutex m_mutex;
+    QWaitCondition m_itemsAvailable;
+    QWaitCondition m_spaceAvailable;
+    QWaitCondition m_drained;
+    QList<Item> m_queue;
+    qint64 m_queueSize;
+    bool m_writing;
+    bool m_quit;
+    Statistics m_statistics;
+};
+
+} // namespace NMakeFile
+
+#endif // CONSOLEWRITER_H
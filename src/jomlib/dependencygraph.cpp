@@ -24,9 +24,12 @@
 ****************************************************************************/
 
 #include "dependencygraph.h"
+#include "consolewriter.h"
+#include "exception.h"
 #include "makefile.h"
 #include "options.h"
 #include "fastfileinfo.h"
+#include "submakefiles.h"
 
 #include <QFile>
 #include <QDebug>
@@ -36,7 +39,8 @@ namespace NMakeFile {
 
 DependencyGraph::DependencyGraph()
 :   m_root(0),
-    m_bDirtyLeaves(true)
+    m_bDirtyLeaves(true),
+    m_subMakefiles(0)
 {
 }
 
@@ -68,6 +72,8 @@ void DependencyGraph::deleteNode(Node* node)
 void DependencyGraph::build(DescriptionBlock* target)
 {
     m_bDirtyLeaves = true;
+    if (m_subMakefiles)
+        m_subMakefiles->load(target);
     m_root = createNode(target, 0);
     QSet<Node *> seen;
     internalBuild(m_root, seen);
@@ -114,9 +120,10 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
     } else {
         // find latest timestamp of all dependents
         FileTime latestDependentTime;
-        foreach (const QString& dependentName, target->m_dependents) {
+        const QVector<DescriptionBlock *> &dependentTargets = target->dependentTargets();
+        for (int i = 0; i < dependentTargets.count(); ++i) {
             FileTime ts;
-            DescriptionBlock *dependent = target->makefile()->target(dependentName);
+            DescriptionBlock *dependent = dependentTargets.at(i);
             if (dependent) {
                 ts = dependent->m_timeStamp;
                 if (!dependent->m_bFileExists && !dependent->m_commands.isEmpty()) {
@@ -128,7 +135,7 @@ bool DependencyGraph::isTargetUpToDate(DescriptionBlock* target)
             }
 
             if (!ts.isValid()) {
-                FastFileInfo fi(dependentName);
+                FastFileInfo fi(target->m_dependents.at(i));
                 if (fi.exists())
                     ts = fi.lastModified();
             }
@@ -186,20 +193,18 @@ void DependencyGraph::internalBuild(Node *node, QSet<Node *> &seen)
     if (c == seen.count())
         return;
 
-    foreach (const QString& dependentName, node->target->m_dependents) {
-        Makefile* const makefile = node->target->makefile();
-        DescriptionBlock* dependent = makefile->target(dependentName);
-        if (!dependent) {
-            // We don't know dependent "foo" but it may have been defined as "C:\MySourceDir\foo"
-            dependent = makefile->target(makefile->dirPath() + QDir::separator() + dependentName);
-        }
+    const bool isSubMakeTarget = m_subMakefiles && m_subMakefiles->isSubMakeTarget(node->target);
+    QList<Node *> prerequisites;
+    const QVector<DescriptionBlock *> dependentTargets = node->target->dependentTargets();
+    for (int i = 0; i < dependentTargets.count(); ++i) {
+        const QString &dependentName = node->target->m_dependents.at(i);
+        DescriptionBlock* dependent = dependentTargets.at(i);
+        if (!dependent)
+            dependent = findDependent(node->target, dependentName);
         if (!dependent) {
             if (!FastFileInfo(dependentName).exists()) {
-                QByteArray msg = "Error: dependent '";
-                msg += dependentName.toLocal8Bit();
-                msg += "' does not exist.\n";
-                fputs(msg.constData(), stderr);
-                exit(2);
+                QString msg = QLatin1String("dependent '%1' does not exist.");
+                throw Exception(msg.arg(dependentName));
             }
             continue;
         }
@@ -211,10 +216,156 @@ void DependencyGraph::internalBuild(Node *node, QSet<Node *> &seen)
             child = createNode(dependent, node);
 
         internalBuild(child, seen);
+        if (isSubMakeTarget)
+            prerequisites.append(child);
+    }
+
+    if (isSubMakeTarget) {
+        foreach (DescriptionBlock *goal, m_subMakefiles->goals(node->target)) {
+            Node* child = m_nodeContainer.value(goal);
+            if (child)
+                addEdge(node, child);
+            else
+                child = createNode(goal, node);
+            internalBuild(child, seen);
+        }
+        gateSubMakeGoals(node, prerequisites);
     }
 
     if (node->children.isEmpty())
         m_leaves.append(node);
+
+    // The targets in the order of a depth-first traversal, children before parents.
+    m_buildOrder.append(node->target);
+}
+
+/**
+ * Looks up a dependent that is not a target of the makefile under its
+ * absolute path and in the other makefiles of the global graph.
+ */
+DescriptionBlock *DependencyGraph::findDependent(DescriptionBlock *target,
+                                                 const QString &dependentName) const
+{
+    // We don't know dependent "foo" but it may have been defined as "C:\MySourceDir\foo"
+    Makefile* const makefile = target->makefile();
+    DescriptionBlock* dependent
+            = makefile->target(makefile->dirPath() + QDir::separator() + dependentName);
+    if (!dependent && m_subMakefiles) {
+        // The dependent may be built by another makefile of the global graph.
+        dependent = m_subMakefiles->findTarget(dependentName, makefile);
+    }
+    return dependent;
+}
+
+/**
+ * Lets the targets of a sub-make wait for the other prerequisites of the
+ * sub-make target, as if the sub-make was run after them. Every target of
+ * the sub-make's makefiles that doesn't depend on another target of these
+ * makefiles gets an edge to the prerequisites.
+ *
+ * A prerequisite that is a sub-make target itself is waited for, unless a
+ * target of this sub-make already depends on one of its targets. Then the
+ * targets are only ordered by their real dependencies.
+ */
+void DependencyGraph::gateSubMakeGoals(Node *node, const QList<Node *> &dependents)
+{
+    if (dependents.isEmpty())
+        return;
+
+    QSet<Makefile *> makefiles;
+    QList<Node *> stack;
+    foreach (DescriptionBlock *goal, m_subMakefiles->goals(node->target)) {
+        makefiles.insert(goal->makefile());
+        stack.append(m_nodeContainer.value(goal));
+    }
+
+    // The targets of these makefiles that the goals depend on.
+    QSet<Node *> localNodes;
+    while (!stack.isEmpty()) {
+        Node *n = stack.takeLast();
+        if (localNodes.contains(n))
+            continue;
+        localNodes.insert(n);
+        foreach (Node *child, n->children) {
+            if (makefiles.contains(child->target->makefile()))
+                stack.append(child);
+        }
+    }
+
+    QList<Node *> prerequisites;
+    foreach (Node *dependent, dependents) {
+        if (m_subMakefiles->isSubMakeTarget(dependent->target)) {
+            const QSet<Node *> dependentNodes = reachableNodes(QList<Node *>() << dependent);
+            bool isLinked = false;
+            foreach (Node *n, localNodes) {
+                if (dependentNodes.contains(n))
+                    continue;
+                foreach (Node *child, n->children) {
+                    if (dependentNodes.contains(child)) {
+                        isLinked = true;
+                        break;
+                    }
+                }
+                if (isLinked)
+                    break;
+            }
+            if (isLinked)
+                continue;
+        }
+        prerequisites.append(dependent);
+    }
+    if (prerequisites.isEmpty())
+        return;
+
+    // Nodes the prerequisites depend on must not wait for them.
+    const QSet<Node *> reachable = reachableNodes(prerequisites);
+    foreach (Node *n, localNodes) {
+        if (reachable.contains(n))
+            continue;
+
+        bool hasLocalChild = false;
+        foreach (Node *child, n->children) {
+            if (makefiles.contains(child->target->makefile())) {
+                hasLocalChild = true;
+                break;
+            }
+        }
+        if (!hasLocalChild) {
+            foreach (Node *prerequisite, prerequisites)
+                addEdge(n, prerequisite);
+            m_leaves.removeOne(n);
+        }
+    }
+}
+
+/**
+ * Returns the given nodes and all nodes they depend on.
+ */
+QSet<DependencyGraph::Node *> DependencyGraph::reachableNodes(const QList<Node *> &nodes)
+{
+    QSet<Node *> reachable;
+    QList<Node *> stack = nodes;
+    while (!stack.isEmpty()) {
+        Node *n = stack.takeLast();
+        if (!reachable.contains(n)) {
+            reachable.insert(n);
+            stack += n->children;
+        }
+    }
+    return reachable;
+}
+
+/**
+ * Returns the name of the node's target. Targets of sub-makefiles are
+ * prefixed with the name of their makefile.
+ */
+QString DependencyGraph::nodeName(Node *node) const
+{
+    const Makefile *makefile = node->target->makefile();
+    if (!m_root || makefile == m_root->target->makefile())
+        return node->target->targetName();
+    return QDir::toNativeSeparators(makefile->fileName()) + QLatin1Char(':')
+            + node->target->targetName();
 }
 
 void DependencyGraph::dump()
@@ -225,7 +376,7 @@ void DependencyGraph::dump()
 
 void DependencyGraph::internalDump(Node* node, QString& indent)
 {
-    puts(qPrintable(QString(indent + node->target->targetName())));
+    puts(qPrintable(QString(indent + nodeName(node))));
     indent.append(QLatin1Char(' '));
     foreach (Node* child, node->children) {
         internalDump(child, indent);
@@ -244,11 +395,11 @@ void DependencyGraph::dotDump()
 void DependencyGraph::internalDotDump(Node* node, const QString& parent)
 {
     if (!parent.isNull()) {
-        QByteArray line = "  \"" + parent.toLocal8Bit() + "\" -> \"" + node->target->targetName().toLocal8Bit() + "\";";
+        QByteArray line = "  \"" + parent.toLocal8Bit() + "\" -> \"" + nodeName(node).toLocal8Bit() + "\";";
         puts(line);
     }
     foreach (Node* child, node->children) {
-        internalDotDump(child, node->target->targetName());
+        internalDotDump(child, nodeName(node));
     }
 }
 
@@ -258,6 +409,7 @@ void DependencyGraph::clear()
     qDeleteAll(m_nodeContainer);
     m_nodeContainer.clear();
     m_leaves.clear();
+    m_buildOrder.clear();
 }
 
 void DependencyGraph::addEdge(Node* parent, Node* child)
@@ -321,16 +473,23 @@ DescriptionBlock *DependencyGraph::findAvailableTarget(bool ignoreTimeStamps)
     // apply inference rules separated by makefiles
     QSet<Makefile*> makefileSet;
     QMultiHash<Makefile*, DescriptionBlock*> multiHash;
+    bool isExecuting = false;
     foreach (Node *leaf, m_leaves) {
         makefileSet.insert(leaf->target->makefile());
         multiHash.insert(leaf->target->makefile(), leaf->target);
+        if (leaf->state == Node::ExecutingState)
+            isExecuting = true;
     }
+
+    // Batches may wait for more targets only while other targets are built.
+    // Otherwise no new leaves can show up.
     foreach (Makefile *mf, makefileSet)
-        mf->applyInferenceRules(multiHash.values(mf));
+        mf->applyInferenceRules(multiHash.values(mf), isExecuting);
 
     // return the first leaf that is not currently executed
     foreach (Node *leaf, m_leaves) {
-        if (leaf->state != Node::ExecutingState) {
+        if (leaf->state != Node::ExecutingState
+                && !leaf->target->makefile()->isPendingBatchModeTarget(leaf->target)) {
             if (leaf->state != Node::Unbuildable)
                 leaf->state = Node::ExecutingState;
             displayNodeBuildInfo(leaf, ignoreTimeStamps ? isTargetUpToDate(leaf->target) : false);
@@ -350,8 +509,8 @@ void DependencyGraph::displayNodeBuildInfo(Node* node, bool isUpToDate)
         else
             msg = "*";
         msg += node->target->m_timeStamp.toString().toLocal8Bit() + " " +
-               node->target->targetName().toLocal8Bit();
-        puts(msg);
+               node->target->targetName().toLocal8Bit() + '\n';
+        ConsoleWriter::instance()->write(stdout, msg, ConsoleWriter::TextMode);
     }
 }
 
@@ -32,6 +32,7 @@
 namespace NMakeFile {
 
 class DescriptionBlock;
+class SubMakefiles;
 
 class DependencyGraph
 {
@@ -39,10 +40,13 @@ public:
     DependencyGraph();
     ~DependencyGraph();
 
+    void setSubMakefiles(SubMakefiles *subMakefiles) { m_subMakefiles = subMakefiles; }
     void build(DescriptionBlock* target);
     void markParentsRecursivlyUnbuildable(DescriptionBlock *target);
     bool isUnbuildable(DescriptionBlock *target) const;
     bool isEmpty() const;
+    bool contains(DescriptionBlock *target) const { return m_nodeContainer.contains(target); }
+    const QList<DescriptionBlock *> &buildOrder() const { return m_buildOrder; }
     void removeLeaf(DescriptionBlock* target);
     DescriptionBlock *findAvailableTarget(bool ignoreTimeStamps);
     void dump();
@@ -67,6 +71,10 @@ private:
     void removeLeaf(Node* node);
     void internalBuild(Node *node, QSet<Node *> &seen);
     void addEdge(Node* parent, Node* child);
+    DescriptionBlock *findDependent(DescriptionBlock *target, const QString &dependentName) const;
+    void gateSubMakeGoals(Node *node, const QList<Node *> &dependents);
+    static QSet<Node *> reachableNodes(const QList<Node *> &nodes);
+    QString nodeName(Node *node) const;
     void internalDump(Node* node, QString& indent);
     void internalDotDump(Node* node, const QString& parent);
     void displayNodeBuildInfo(Node* node, bool isUpToDate);
@@ -76,7 +84,9 @@ private:
     Node* m_root;
     QHash<DescriptionBlock*, Node*> m_nodeContainer;
     QList<Node *> m_leaves;
+    QList<DescriptionBlock *> m_buildOrder;
     bool m_bDirtyLeaves;
+    SubMakefiles *m_subMakefiles;
 };
 
 } // namespace NMakeFile
@@ -91,6 +91,14 @@ FileTime FastFileInfo::lastModified() const
     }
 }
 
+qint64 FastFileInfo::size() const
+{
+    const WIN32_FILE_ATTRIBUTE_DATA *fattr = z(m_attributes);
+    if (fattr->dwFileAttributes == INVALID_FILE_ATTRIBUTES)
+        return 0;
+    return (qint64(fattr->nFileSizeHigh) << 32) | fattr->nFileSizeLow;
+}
+
 void FastFileInfo::clearCacheForFile(const QString &fileName)
 {
     fadHash.remove(fileName);
@@ -37,6 +37,7 @@ public:
 
     bool exists() const;
     FileTime lastModified() const;
+    qint64 size() const;
 
     static void clearCacheForFile(const QString &fileName);
 
@@ -0,0 +1,265 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "includeprefetcher.h"
+#include "helperfunctions.h"
+#include "linetokenizer.h"
+#include "makefilelinereader.h"
+#include "preprocessor.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRunnable>
+
+#include <climits>
+
+namespace NMakeFile {
+
+class IncludePrefetcher::Job : public QRunnable
+{
+public:
+    Job(IncludePrefetcher *prefetcher, const QString &filePath)
+        : m_prefetcher(prefetcher), m_filePath(filePath)
+    {
+    }
+
+    void run()
+    {
+        m_prefetcher->load(m_filePath);
+    }
+
+private:
+    IncludePrefetcher *m_prefetcher;
+    QString m_filePath;
+};
+
+IncludePrefetcher::IncludePrefetcher()
+    : m_stopping(false)
+{
+}
+
+IncludePrefetcher::~IncludePrefetcher()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+    }
+    m_threadPool.waitForDone();
+}
+
+/**
+ * Starts reading the file with the given absolute path in the background.
+ * Every file is read at most once.
+ */
+void IncludePrefetcher::prefetch(const QString &filePath)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_stopping || m_requestedFiles.contains(filePath))
+        return;
+    m_requestedFiles.insert(filePath);
+    Entry &entry = m_entries[filePath];
+    entry.state = Queued;
+    m_threadPool.start(new Job(this, filePath));
+}
+
+void IncludePrefetcher::prefetch(const QStringList &filePaths)
+{
+    foreach (const QString &filePath, filePaths)
+        prefetch(filePath);
+}
+
+/**
+ * Returns the decoded content of the file with the given absolute path.
+ *
+ * If the file is being read in the background, this function waits for it.
+ * A null string is returned if the file was not prefetched, if its job did not
+ * start yet, if it was modified after it had been read or if it cannot be read.
+ * The caller must read the file itself then.
+ */
+QString IncludePrefetcher::take(const QString &filePath)
+{
+    QMutexLocker locker(&m_mutex);
+    m_requestedFiles.insert(filePath);
+    QHash<QString, Entry>::iterator it = m_entries.find(filePath);
+    if (it == m_entries.end()) {
+        if (!m_stopping)
+            m_threadPool.start(new Job(this, filePath));    // finds no entry and scans the file
+        return QString();
+    }
+
+    if (it->state == Queued) {
+        // The job will find no entry and scan the file.
+        m_entries.erase(it);
+        return QString();
+    }
+
+    while (it->state == Loading) {
+        m_loaded.wait(&m_mutex);
+        it = m_entries.find(filePath);
+    }
+    const Entry entry = *it;
+    m_entries.erase(it);
+    locker.unlock();
+
+    const QFileInfo fileInfo(filePath);
+    if (fileInfo.size() != entry.size || fileInfo.lastModified() != entry.lastModified)
+        return QString();
+    return entry.content;
+}
+
+/**
+ * Blocks until all files that were requested so far have been read or scanned.
+ */
+void IncludePrefetcher::waitForDone()
+{
+    m_threadPool.waitForDone();
+}
+
+/**
+ * Returns the file names of the include directives in content that do not
+ * contain macro invocations. Angle brackets and double quotes are removed.
+ */
+QStringList IncludePrefetcher::literalIncludeFiles(const QString &content)
+{
+    QStringList result;
+    QString directive, value;
+    int lineStart = 0;
+    while (lineStart < content.length()) {
+        int lineEnd = content.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd < 0)
+            lineEnd = content.length();
+
+        const QChar firstChar = content.at(lineStart);
+        value.clear();
+        if (firstChar == QLatin1Char('!')) {
+            const QString line = content.mid(lineStart, lineEnd - lineStart).trimmed();
+            if (LineTokenizer::isPreprocessingDirective(line, &directive, &value)
+                    && directive != QLatin1String("INCLUDE")) {
+                value.clear();
+            }
+        } else if (firstChar == QLatin1Char('i') || firstChar == QLatin1Char('I')) {
+            const QString line = content.mid(lineStart, lineEnd - lineStart).trimmed();
+            if (line.length() > 8 && isSpaceOrTab(line.at(7))
+                    && line.startsWith(QLatin1String("include"), Qt::CaseInsensitive)) {
+                value = line.mid(8).trimmed();
+            }
+        }
+        lineStart = lineEnd + 1;
+
+        // Skip macro invocations and continued lines.
+        if (value.isEmpty() || value.contains(QLatin1Char('$'))
+                || value.endsWith(QLatin1Char('\\')) || value.endsWith(QLatin1Char('^'))) {
+            continue;
+        }
+
+        Preprocessor::removeInlineComments(value);
+        if (value.startsWith(QLatin1Char('<')) && value.endsWith(QLatin1Char('>'))) {
+            value.chop(1);
+            value.remove(0, 1);
+        }
+        removeDoubleQuotes(value);
+        if (!value.isEmpty())
+            result.append(value);
+    }
+    return result;
+}
+
+QString IncludePrefetcher::readFile(const QString &filePath)
+{
+    QFile file(filePath);
+    if (!file.open(QIODevice::ReadOnly) || file.size() >= INT_MAX)
+        return QString();
+    return MakefileLineReader::decodeContent(file.readAll());
+}
+
+/**
+ * Runs in a thread of the pool.
+ */
+void IncludePrefetcher::load(const QString &filePath)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_stopping)
+            return;
+        QHash<QString, Entry>::iterator it = m_entries.find(filePath);
+        if (it == m_entries.end()) {
+            locker.unlock();
+            scan(filePath);
+            return;
+        }
+        if (it->state != Queued)
+            return;
+        it->state = Loading;
+    }
+
+    // Look at the file before reading it. A modification during the read is detected by take().
+    const QFileInfo fileInfo(filePath);
+    const qint64 size = fileInfo.size();
+    const QDateTime lastModified = fileInfo.lastModified();
+    const QString content = readFile(filePath);
+
+    {
+        QMutexLocker locker(&m_mutex);
+        Entry &entry = m_entries[filePath];
+        entry.content = content;
+        entry.size = size;
+        entry.lastModified = lastModified;
+        entry.state = Finished;
+        m_loaded.wakeAll();
+    }
+
+    prefetchIncludes(content, QFileInfo(filePath).absolutePath());
+}
+
+/**
+ * Prefetches the includes of a file that the preprocessor reads itself.
+ * Large files, typically generated ones, are not scanned. Decoding them
+ * a second time would cost more memory than prefetching their includes saves.
+ */
+void IncludePrefetcher::scan(const QString &filePath)
+{
+    static const qint64 maxScannedFileSize = 4 * 1024 * 1024;
+    if (QFileInfo(filePath).size() > maxScannedFileSize)
+        return;
+    prefetchIncludes(readFile(filePath), QFileInfo(filePath).absolutePath());
+}
+
+/**
+ * Prefetches the literal include files of content. Like the preprocessor,
+ * the file names are resolved against the current directory first and
+ * against the directory of the including file second.
+ */
+void IncludePrefetcher::prefetchIncludes(const QString &content, const QString &directory)
+{
+    foreach (const QString &fileName, literalIncludeFiles(content)) {
+        QFileInfo fi(fileName);
+        if (!fi.exists())
+            fi.setFile(directory + QLatin1Char('/') + fileName);
+        if (fi.exists())
+            prefetch(fi.absoluteFilePath());
+    }
+}
+
+} // namespace NMakeFile
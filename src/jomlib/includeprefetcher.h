@@ -0,0 +1,98 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef INCLUDEPREFETCHER_H
+#define INCLUDEPREFETCHER_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
+
+namespace NMakeFile {
+
+/**
+ * Reads and decodes makefiles on background threads.
+ *
+ * Every file that is taken from the prefetcher is scanned for include
+ * directives with literal file names. Those files are read in the background,
+ * while the preprocessor is still busy with the lines in front of the
+ * directive. The files that were read by a previous run can be prefetched
+ * right at the start.
+ *
+ * The prefetcher only guesses which files will be included. Guesses that
+ * turn out to be wrong cost a file read, but do not change the result.
+ * Files that were modified after they were read, e.g. by a shell command in
+ * a preprocessor expression, are not handed out.
+ *
+ * Files that were not prefetched are not read by the prefetcher. The caller
+ * reads those itself. They are only scanned for includes in the background.
+ */
+class IncludePrefetcher
+{
+public:
+    IncludePrefetcher();
+    ~IncludePrefetcher();
+
+    void prefetch(const QString &filePath);
+    void prefetch(const QStringList &filePaths);
+    QString take(const QString &filePath);
+    void waitForDone();
+
+    static QStringList literalIncludeFiles(const QString &content);
+
+private:
+    class Job;
+    friend class Job;
+
+    enum State { Queued, Loading, Finished };
+
+    struct Entry
+    {
+        State state;
+        QString content;
+        qint64 size;
+        QDateTime lastModified;
+    };
+
+    static QString readFile(const QString &filePath);
+    void load(const QString &filePath);
+    void scan(const QString &filePath);
+    void prefetchIncludes(const QString &content, const QString &directory);
+
+    QThreadPool m_threadPool;
+    QMutex m_mutex;
+    QWaitCondition m_loaded;
+    QHash<QString, Entry> m_entries;
+    QSet<QString> m_requestedFiles;
+    bool m_stopping;
+};
+
+} // namespace NMakeFile
+
+#endif // INCLUDEPREFETCHER_H
@@ -24,6 +24,7 @@
 ****************************************************************************/
 
 #include "iocompletionport.h"
+#include "consolewriter.h"
 
 namespace NMakeFile {
 
@@ -97,7 +98,9 @@ void IoCompletionPort::run()
 
         DWORD errorCode = success ? ERROR_SUCCESS : GetLastError();
         if (!success && !overlapped) {
-            printf("GetQueuedCompletionStatus failed with error code %d.\n", errorCode);
+            ConsoleWriter::instance()->write(stdout,
+                    "GetQueuedCompletionStatus failed with error code "
+                    + QByteArray::number(quint32(errorCode)) + ".\n", ConsoleWriter::TextMode);
             return;
         }
 
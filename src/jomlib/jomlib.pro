@@ -65,19 +65,26 @@ HEADERS +=  \
     fastfileinfo.h \
     filetime.h \
     helperfunctions.h \
+    includeprefetcher.h \
     jobserver.h \
+    linetokenizer.h \
     makefile.h \
+    makefilecache.h \
     makefilefactory.h \
     makefilelinereader.h \
+    nestedbuild.h \
     macrotable.h \
     exception.h \
     dependencygraph.h \
     options.h \
+    outputbuffer.h \
     parser.h \
     preprocessor.h \
     ppexprparser.h \
+    submakefiles.h \
     targetexecutor.h \
     commandexecutor.h \
+    consolewriter.h \
     jomprocess.h \
     processenvironment.h \
     jobclient.h \
@@ -87,20 +94,27 @@ SOURCES += \
     fastfileinfo.cpp \
     filetime.cpp \
     helperfunctions.cpp \
+    includeprefetcher.cpp \
     jobserver.cpp \
+    linetokenizer.cpp \
     macrotable.cpp \
     makefile.cpp \
+    makefilecache.cpp \
     makefilefactory.cpp \
     makefilelinereader.cpp \
+    nestedbuild.cpp \
     exception.cpp \
     dependencygraph.cpp \
     options.cpp \
+    outputbuffer.cpp \
     parser.cpp \
     preprocessor.cpp \
     ppexpr_grammar.cpp \
     ppexprparser.cpp \
+    submakefiles.cpp \
     targetexecutor.cpp \
     commandexecutor.cpp \
+    consolewriter.cpp \
     jobclient.cpp \
     jobclientacquirehelper.cpp
 
@@ -25,15 +25,19 @@
 
 #define _CRT_RAND_S
 #include <cstdlib>
+#include <cstring>
 
 #include "jomprocess.h"
+#include "consolewriter.h"
+#include "exception.h"
 #include "helperfunctions.h"
 #include "iocompletionport.h"
+#include "outputbuffer.h"
 
 #include <QByteArray>
 #include <QEventLoop>
 #include <QDir>
-#include <QElapsedTimer>
+#include <QIODevice>
 #include <QMap>
 #include <QMetaType>
 #include <QMutex>
@@ -42,9 +46,7 @@
 #include <QWinEventNotifier>
 
 #include <qt_windows.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <io.h>
+#include <psapi.h>
 
 #ifndef PIPE_REJECT_REMOTE_CLIENTS
 #define PIPE_REJECT_REMOTE_CLIENTS 0x08
@@ -52,8 +54,6 @@
 
 namespace NMakeFile {
 
-Q_GLOBAL_STATIC(QElapsedTimer, runtime)
-
 struct Pipe
 {
     Pipe()
@@ -84,17 +84,6 @@ static void safelyCloseHandle(HANDLE &h)
     }
 }
 
-struct TimeStampedBuffer
-{
-    TimeStampedBuffer(const qint64 t, const QByteArray &b)
-        : timestamp(t), buffer(b)
-    {
-    }
-
-    qint64 timestamp;
-    QByteArray buffer;
-};
-
 class ProcessPrivate;
 
 class OutputChannel : public IoCompletionPortObserver
@@ -106,9 +95,8 @@ public:
     ProcessPrivate *d;
     Pipe *pipe;
     FILE *stream;
+    OutputBuffer::Channel channel;
     QByteArray intermediateOutputBuffer;
-    QList<TimeStampedBuffer> buffers;
-    QMutex outputBufferLock;
 };
 
 class ProcessPrivate
@@ -118,26 +106,36 @@ public:
         : q(process),
           hProcess(INVALID_HANDLE_VALUE),
           hProcessThread(INVALID_HANDLE_VALUE),
+          hJob(INVALID_HANDLE_VALUE),
           exitCode(STILL_ACTIVE)
     {
         stdoutChannel.d = this;
         stdoutChannel.pipe = &stdoutPipe;
         stdoutChannel.stream = stdout;
+        stdoutChannel.channel = OutputBuffer::StdOut;
         stderrChannel.d = this;
         stderrChannel.pipe = &stderrPipe;
         stderrChannel.stream = stderr;
+        stderrChannel.channel = OutputBuffer::StdErr;
     }
 
     bool startRead();
+    void appendLineOutput(OutputBuffer::Channel channel, const char *data, int length);
+    void flushLineOutput();
 
     Process *q;
     HANDLE hProcess;
     HANDLE hProcessThread;
+    HANDLE hJob;        // contains the child process and all processes it starts
     Pipe stdoutPipe;
     Pipe stderrPipe;
     Pipe stdinPipe;     // we don't use it but some processes demand it (e.g. xcopy)
     OutputChannel stdoutChannel;
     OutputChannel stderrChannel;
+    OutputBuffer outputBuffer;
+    QByteArray partialLines[2];
+    QByteArray linePrefix;
+    QMutex outputBufferLock;
     QMutex bufferedOutputModeSwitchMutex;
     DWORD exitCode;
     QWinEventNotifier deathNotifier;
@@ -146,10 +144,14 @@ public:
 Process::Process(QObject *parent)
     : QObject(parent),
       d(new ProcessPrivate(this)),
+      m_environment(0),
+      m_envBlockVersion(0),
       m_state(NotRunning),
       m_exitCode(0),
       m_exitStatus(NormalExit),
-      m_bufferedOutput(true)
+      m_bufferedOutput(true),
+      m_lineOutput(false),
+      m_outputCapture(false)
 {
     static bool staticsInitialized = false;
     if (!staticsInitialized) {
@@ -157,7 +159,6 @@ Process::Process(QObject *parent)
         qRegisterMetaType<ExitStatus>("Process::ExitStatus");
         qRegisterMetaType<ProcessError>("Process::ProcessError");
         qRegisterMetaType<ProcessState>("Process::ProcessState");
-        runtime()->start();
     }
     connect(&d->deathNotifier, &QWinEventNotifier::activated,
             this, &Process::tryToRetrieveExitCode);
@@ -170,6 +171,8 @@ Process::~Process()
 
     if (m_state == Running)
         qWarning("Process: destroyed while process still running.");
+    d->flushLineOutput();
+    ConsoleWriter::instance()->waitForSpace();
     printBufferedOutput();
     delete d;
 }
@@ -188,18 +191,66 @@ void Process::setBufferedOutput(bool b)
     d->bufferedOutputModeSwitchMutex.unlock();
 }
 
+/**
+ * In line output mode every line of the process' output is written to the console
+ * as soon as it is complete. Every line is prefixed with the output line prefix.
+ * Line output mode implies buffered output.
+ */
+void Process::setLineOutput(bool b)
+{
+    if (m_lineOutput == b)
+        return;
+
+    d->bufferedOutputModeSwitchMutex.lock();
+    m_lineOutput = b;
+    if (m_lineOutput)
+        m_bufferedOutput = true;
+    else
+        d->flushLineOutput();
+    d->bufferedOutputModeSwitchMutex.unlock();
+    ConsoleWriter::instance()->waitForSpace();
+}
+
+void Process::setOutputLinePrefix(const QByteArray &prefix)
+{
+    d->outputBufferLock.lock();
+    d->linePrefix = prefix;
+    d->outputBufferLock.unlock();
+}
+
+/**
+ * Sets the amount of buffered output that is kept in memory.
+ * Output beyond that limit is written to a temporary file until it is printed.
+ */
+void Process::setOutputMemoryLimit(qint64 limit)
+{
+    d->outputBufferLock.lock();
+    d->outputBuffer.setMemoryLimit(limit);
+    d->outputBufferLock.unlock();
+}
+
 void Process::writeToStdOutBuffer(const QByteArray &output)
 {
-    d->stdoutChannel.outputBufferLock.lock();
-    d->stdoutChannel.buffers.append(TimeStampedBuffer(runtime()->elapsed(), output));
-    d->stdoutChannel.outputBufferLock.unlock();
+    d->outputBufferLock.lock();
+    if (m_lineOutput)
+        d->appendLineOutput(OutputBuffer::StdOut, output.constData(), output.size());
+    else
+        d->outputBuffer.append(OutputBuffer::StdOut, output.constData(), output.size());
+    d->outputBufferLock.unlock();
+    if (m_lineOutput)
+        ConsoleWriter::instance()->waitForSpace();
 }
 
 void Process::writeToStdErrBuffer(const QByteArray &output)
 {
-    d->stderrChannel.outputBufferLock.lock();
-    d->stderrChannel.buffers.append(TimeStampedBuffer(runtime()->elapsed(), output));
-    d->stderrChannel.outputBufferLock.unlock();
+    d->outputBufferLock.lock();
+    if (m_lineOutput)
+        d->appendLineOutput(OutputBuffer::StdErr, output.constData(), output.size());
+    else
+        d->outputBuffer.append(OutputBuffer::StdErr, output.constData(), output.size());
+    d->outputBufferLock.unlock();
+    if (m_lineOutput)
+        ConsoleWriter::instance()->waitForSpace();
 }
 
 void Process::setWorkingDirectory(const QString &path)
@@ -274,10 +325,11 @@ static QByteArray createEnvBlock(const ProcessEnvironment &environment)
     return envlist;
 }
 
-void Process::setEnvironment(const ProcessEnvironment &environment)
+void Process::setEnvironment(const SharedProcessEnvironment *environment)
 {
     m_environment = environment;
-    m_envBlock = createEnvBlock(environment);
+    m_envBlock.clear();
+    m_envBlockVersion = 0;
 }
 
 enum PipeType { InputPipe, OutputPipe };
@@ -347,17 +399,24 @@ static bool setupPipe(Pipe &pipe, SECURITY_ATTRIBUTES *sa, PipeType pt)
 void Process::start(const QString &commandLine)
 {
     m_state = Starting;
+    m_resourceUsage = ProcessResourceUsage();
 
     SECURITY_ATTRIBUTES sa = {0};
     sa.nLength = sizeof(sa);
     sa.bInheritHandle = TRUE;
 
+    const char *failedPipe = 0;
     if (!setupPipe(d->stdinPipe, &sa, InputPipe))
-        qFatal("Cannot setup pipe for stdin.");
-    if (!setupPipe(d->stdoutPipe, &sa, OutputPipe))
-        qFatal("Cannot setup pipe for stdout.");
-    if (!setupPipe(d->stderrPipe, &sa, OutputPipe))
-        qFatal("Cannot setup pipe for stderr.");
+        failedPipe = "stdin";
+    else if (!setupPipe(d->stdoutPipe, &sa, OutputPipe))
+        failedPipe = "stdout";
+    else if (!setupPipe(d->stderrPipe, &sa, OutputPipe))
+        failedPipe = "stderr";
+    if (failedPipe) {
+        m_state = NotRunning;
+        QString msg = QLatin1String("Cannot setup pipe for %1.");
+        throw Exception(msg.arg(QLatin1String(failedPipe)));
+    }
 
     IoCompletionPort::instance()->registerObserver(&d->stdoutChannel, d->stdoutPipe.hRead);
     IoCompletionPort::instance()->registerObserver(&d->stderrChannel, d->stderrPipe.hRead);
@@ -375,7 +434,15 @@ void Process::start(const QString &commandLine)
     si.hStdError = d->stderrPipe.hWrite;
     si.dwFlags = STARTF_USESTDHANDLES;
 
+    // The child is put into a job object before it runs. The resource usage of
+    // the job includes the processes the child starts, e.g. the compiler that
+    // is started by cmd.exe.
     DWORD dwCreationFlags = CREATE_UNICODE_ENVIRONMENT;
+    d->hJob = CreateJobObject(NULL, NULL);
+    if (d->hJob)
+        dwCreationFlags |= CREATE_SUSPENDED;
+    else
+        d->hJob = INVALID_HANDLE_VALUE;
     PROCESS_INFORMATION pi;
     wchar_t *strCommandLine = _wcsdup((const wchar_t*)commandLine.utf16());     // CreateProcess can modify this string
     const wchar_t *strWorkingDir = 0;
@@ -383,6 +450,12 @@ void Process::start(const QString &commandLine)
         m_workingDirectory = QDir::toNativeSeparators(m_workingDirectory);
         strWorkingDir = (const wchar_t*)m_workingDirectory.utf16();
     }
+    if (m_environment && m_envBlockVersion != m_environment->version()) {
+        // The environment block is only rebuilt if the shared environment has
+        // been changed since our last start.
+        m_envBlock = createEnvBlock(m_environment->environment());
+        m_envBlockVersion = m_environment->version();
+    }
     void *envBlock = (m_envBlock.isEmpty() ? 0 : m_envBlock.data());
     BOOL bResult = CreateProcess(NULL, strCommandLine,
                                  0, 0, TRUE, dwCreationFlags, envBlock,
@@ -390,10 +463,18 @@ void Process::start(const QString &commandLine)
     free(strCommandLine);
     strCommandLine = 0;
     if (!bResult) {
+        safelyCloseHandle(d->hJob);
         m_state = NotRunning;
         emit error(FailedToStart);
         return;
     }
+    if (d->hJob != INVALID_HANDLE_VALUE) {
+        // Assigning fails if jom runs in a job that doesn't allow nested jobs.
+        // Then only the child process itself is accounted.
+        if (!AssignProcessToJobObject(d->hJob, pi.hProcess))
+            safelyCloseHandle(d->hJob);
+        ResumeThread(pi.hThread);
+    }
 
     // Close the pipe handles. This process doesn't need them anymore.
     safelyCloseHandle(d->stdinPipe.hRead);
@@ -428,11 +509,16 @@ void Process::onProcessFinished()
     d->deathNotifier.setEnabled(false);
     IoCompletionPort::instance()->unregisterObserver(&d->stdoutChannel);
     IoCompletionPort::instance()->unregisterObserver(&d->stderrChannel);
+    retrieveResourceUsage();
+    d->flushLineOutput();
+    ConsoleWriter::instance()->waitForSpace();
     safelyCloseHandle(d->stdoutPipe.hRead);
     safelyCloseHandle(d->stderrPipe.hRead);
     safelyCloseHandle(d->hProcess);
     safelyCloseHandle(d->hProcessThread);
-    printBufferedOutput();
+    safelyCloseHandle(d->hJob);
+    if (!m_outputCapture)
+        printBufferedOutput();
     m_state = NotRunning;
     m_exitCode = d->exitCode;
     d->exitCode = STILL_ACTIVE;
@@ -443,6 +529,59 @@ void Process::onProcessFinished()
     emit finished(m_exitCode, exitStatus);
 }
 
+static qint64 fileTimeToMSecs(const FILETIME &ft)
+{
+    ULARGE_INTEGER li;
+    li.LowPart = ft.dwLowDateTime;
+    li.HighPart = ft.dwHighDateTime;
+    return li.QuadPart / 10000;     // FILETIME is measured in 100 ns intervals.
+}
+
+/**
+ * Retrieves the resources the finished child process and the processes it
+ * started consumed. The peak memory is the largest amount of memory that
+ * one of these processes committed.
+ * If the child could not be put into a job object, only the child process
+ * itself is accounted and the peak memory is its peak working set.
+ * Must be called before the process and job handles are closed.
+ */
+void Process::retrieveResourceUsage()
+{
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetProcessTimes(d->hProcess, &creationTime, &exitTime, &kernelTime, &userTime)) {
+        m_resourceUsage.wallTime = fileTimeToMSecs(exitTime) - fileTimeToMSecs(creationTime);
+        m_resourceUsage.userTime = fileTimeToMSecs(userTime);
+        m_resourceUsage.kernelTime = fileTimeToMSecs(kernelTime);
+    }
+
+    if (d->hJob != INVALID_HANDLE_VALUE) {
+        JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION accountingInfo;
+        JOBOBJECT_EXTENDED_LIMIT_INFORMATION limitInfo;
+        if (QueryInformationJobObject(d->hJob, JobObjectBasicAndIoAccountingInformation,
+                                      &accountingInfo, sizeof(accountingInfo), NULL)
+                && QueryInformationJobObject(d->hJob, JobObjectExtendedLimitInformation,
+                                             &limitInfo, sizeof(limitInfo), NULL)) {
+            // The job times are measured in 100 ns intervals.
+            m_resourceUsage.userTime = accountingInfo.BasicInfo.TotalUserTime.QuadPart / 10000;
+            m_resourceUsage.kernelTime = accountingInfo.BasicInfo.TotalKernelTime.QuadPart / 10000;
+            m_resourceUsage.peakMemory = limitInfo.PeakProcessMemoryUsed;
+            m_resourceUsage.readBytes = accountingInfo.IoInfo.ReadTransferCount;
+            m_resourceUsage.writeBytes = accountingInfo.IoInfo.WriteTransferCount;
+            return;
+        }
+    }
+
+    PROCESS_MEMORY_COUNTERS memoryCounters;
+    if (GetProcessMemoryInfo(d->hProcess, &memoryCounters, sizeof(memoryCounters)))
+        m_resourceUsage.peakMemory = memoryCounters.PeakWorkingSetSize;
+
+    IO_COUNTERS ioCounters;
+    if (GetProcessIoCounters(d->hProcess, &ioCounters)) {
+        m_resourceUsage.readBytes = ioCounters.ReadTransferCount;
+        m_resourceUsage.writeBytes = ioCounters.WriteTransferCount;
+    }
+}
+
 bool Process::waitForFinished()
 {
     if (m_state != Running)
@@ -491,30 +630,6 @@ bool OutputChannel::startRead()
     return true;
 }
 
-static void fwrite_binary(FILE *stream, const char *str, size_t count)
-{
-    const int fd = _fileno(stream);
-    const int origMode = _setmode(fd, _O_BINARY);
-    if (fwrite(str, sizeof(char), count, stream)) {
-        // Write operation was successful.
-        fflush(stream);
-    } else if (errno == ENOMEM) {
-        // The buffer was too big for writing. Write it in chunks.
-        const size_t chunkSize = 4096;
-        for (;;) {
-            size_t k = qMin(chunkSize, count);
-            fwrite(str, sizeof(char), k, stream);
-            fflush(stream);
-            if (k >= count)
-                break;
-            str += k;
-            count -= k;
-        }
-    }
-    if (origMode != -1)
-        _setmode(fd, origMode);
-}
-
 /**
  * Is called whenever we receive the result of an asynchronous I/O operation.
  * Note: This function is running in the IOCP thread!
@@ -524,16 +639,24 @@ void OutputChannel::completionPortNotified(DWORD numberOfBytes, DWORD errorCode)
     if (numberOfBytes)  {
         d->bufferedOutputModeSwitchMutex.lock();
 
-        if (d->q->isBufferedOutputSet()) {
-            outputBufferLock.lock();
-            QByteArray data(intermediateOutputBuffer.data(), numberOfBytes);
-            buffers.append(TimeStampedBuffer(runtime()->elapsed(), data));
-            outputBufferLock.unlock();
+        if (d->q->isLineOutputSet()) {
+            d->outputBufferLock.lock();
+            d->appendLineOutput(channel, intermediateOutputBuffer.constData(), numberOfBytes);
+            d->outputBufferLock.unlock();
+        } else if (d->q->isBufferedOutputSet()) {
+            d->outputBufferLock.lock();
+            d->outputBuffer.append(channel, intermediateOutputBuffer.constData(), numberOfBytes);
+            d->outputBufferLock.unlock();
         } else {
-            fwrite_binary(stream, intermediateOutputBuffer.data(), numberOfBytes);
+            ConsoleWriter::instance()->enqueue(stream,
+                    QByteArray(intermediateOutputBuffer.constData(), numberOfBytes));
         }
 
         d->bufferedOutputModeSwitchMutex.unlock();
+
+        // Wait for a slow console only after releasing the locks, which the
+        // main thread might be waiting for.
+        ConsoleWriter::instance()->waitForSpace();
     }
 
     if (errorCode == ERROR_SUCCESS)
@@ -543,32 +666,119 @@ void OutputChannel::completionPortNotified(DWORD numberOfBytes, DWORD errorCode)
     QMetaObject::invokeMethod(d->q, "tryToRetrieveExitCode", Qt::QueuedConnection);
 }
 
-void Process::printBufferedOutput()
+static void writeLine(FILE *stream, const QByteArray &prefix, const char *data, int length)
 {
-    while (!d->stdoutChannel.buffers.isEmpty()
-        || !d->stderrChannel.buffers.isEmpty())
-    {
-        OutputChannel *channels[2] = { &d->stdoutChannel, &d->stderrChannel };
-
-        size_t i = 0;
-        if (channels[0]->buffers.isEmpty()
-            || (!channels[1]->buffers.isEmpty()
-                && channels[0]->buffers.first().timestamp > channels[1]->buffers.first().timestamp))
-        {
-            i = 1;
+    // The line is queued as one piece. Lines of different processes cannot interleave.
+    // The caller holds outputBufferLock and must wait for queue space after releasing it.
+    QByteArray line;
+    line.reserve(prefix.size() + length + 1);
+    line.append(prefix);
+    line.append(data, length);
+    if (!length || data[length - 1] != '\n')
+        line.append('\n');
+    ConsoleWriter::instance()->enqueue(stream, line);
+}
+
+/**
+ * Writes every complete line in data to the console.
+ * The rest is kept until the line is completed or the process finishes.
+ * If a line exceeds a certain length, the part we have is written out to keep
+ * the memory usage bounded.
+ * Must be called with outputBufferLock held. The lines are queued without
+ * waiting for the console, see flushLineOutput().
+ */
+void ProcessPrivate::appendLineOutput(OutputBuffer::Channel channel, const char *data, int length)
+{
+    static const int maxPartialLineSize = 64 * 1024;
+    FILE *stream = (channel == OutputBuffer::StdOut) ? stdout : stderr;
+    QByteArray &partialLine = partialLines[channel];
+    const char *end = data + length;
+    while (data < end) {
+        const char *lineEnd = static_cast<const char *>(memchr(data, '\n', end - data));
+        if (!lineEnd) {
+            partialLine.append(data, end - data);
+            if (partialLine.size() >= maxPartialLineSize) {
+                writeLine(stream, linePrefix, partialLine.constData(), partialLine.size());
+                partialLine.resize(0);
+            }
+            return;
+        }
+        ++lineEnd;
+        if (partialLine.isEmpty()) {
+            writeLine(stream, linePrefix, data, lineEnd - data);
+        } else {
+            partialLine.append(data, lineEnd - data);
+            writeLine(stream, linePrefix, partialLine.constData(), partialLine.size());
+            partialLine.resize(0);
         }
+        data = lineEnd;
+    }
+}
 
-        OutputChannel *const channel = channels[i];
-        channel->outputBufferLock.lock();
-        const QByteArray &ba = channel->buffers.first().buffer;
-        fwrite_binary(channel->stream, ba.data(), ba.count());
-        channel->buffers.removeFirst();
-        channel->outputBufferLock.unlock();
+/**
+ * Writes the incomplete lines that are left when the process has finished.
+ * The lines are queued without waiting for the console. The caller must call
+ * ConsoleWriter::waitForSpace() when it doesn't hold any locks anymore.
+ */
+void ProcessPrivate::flushLineOutput()
+{
+    outputBufferLock.lock();
+    for (int i = 0; i < 2; ++i) {
+        QByteArray &partialLine = partialLines[i];
+        if (partialLine.isEmpty())
+            continue;
+        writeLine(i == OutputBuffer::StdOut ? stdout : stderr, linePrefix,
+                  partialLine.constData(), partialLine.size());
+        partialLine.clear();
     }
+    outputBufferLock.unlock();
 }
 
-} // namespace NMakeFile
+/**
+ * Writes the buffered output of both channels in the order it was received
+ * to the console.
+ */
+void Process::printBufferedOutput()
+{
+    flushBufferedOutput(0, true);
+}
 
-QT_BEGIN_NAMESPACE
-Q_DECLARE_TYPEINFO(NMakeFile::TimeStampedBuffer, Q_MOVABLE_TYPE);
-QT_END_NAMESPACE
+/**
+ * Writes the buffered output of both channels in the order it was received
+ * to logFile, if given, and to the console, if printToConsole is set.
+ * The buffer is empty afterwards.
+ *
+ * If output capturing is set, the output of the process is not printed
+ * automatically when the process has finished. The output of several
+ * processes is collected until this function is called.
+ */
+void Process::flushBufferedOutput(QIODevice *logFile, bool printToConsole)
+{
+    OutputBuffer output;
+    takeBufferedOutput(output);
+    if (output.isEmpty())
+        return;
+
+    ConsoleWriter *writer = printToConsole ? ConsoleWriter::instance() : 0;
+    output.forEachChunk([logFile, writer](OutputBuffer::Channel channel, const char *data, int length) {
+        if (logFile)
+            logFile->write(data, length);
+        if (writer) {
+            FILE *stream = (channel == OutputBuffer::StdOut) ? stdout : stderr;
+            writer->write(stream, QByteArray(data, length));
+        }
+    });
+}
+
+/**
+ * Moves the buffered output into output, which must be empty.
+ */
+void Process::takeBufferedOutput(OutputBuffer &output)
+{
+    Q_ASSERT(output.isEmpty());
+    d->outputBufferLock.lock();
+    output.swap(d->outputBuffer);
+    d->outputBufferLock.unlock();
+}
+
+} // namespace NMakeFile
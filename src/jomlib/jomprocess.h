@@ -30,8 +30,50 @@
 #include <QObject>
 #include <QStringList>
 
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
+
+namespace NMakeFile {
+
+class OutputBuffer;
+
+/**
+ * Resources that were consumed by a child process, including the processes
+ * it started. Times are in milliseconds, memory and I/O counters in bytes.
+ */
+struct ProcessResourceUsage
+{
+    ProcessResourceUsage()
+        : wallTime(0), userTime(0), kernelTime(0),
+          peakMemory(0), readBytes(0), writeBytes(0)
+    {
+    }
+
+    ProcessResourceUsage &operator+=(const ProcessResourceUsage &other)
+    {
+        wallTime += other.wallTime;
+        userTime += other.userTime;
+        kernelTime += other.kernelTime;
+        peakMemory = qMax(peakMemory, other.peakMemory);
+        readBytes += other.readBytes;
+        writeBytes += other.writeBytes;
+        return *this;
+    }
+
+    qint64 wallTime;
+    qint64 userTime;
+    qint64 kernelTime;
+    quint64 peakMemory;
+    quint64 readBytes;
+    quint64 writeBytes;
+};
+
+} // namespace NMakeFile
+
 #ifdef USE_QPROCESS
 
+#include <QElapsedTimer>
 #include <QProcess>
 
 namespace NMakeFile {
@@ -56,13 +98,22 @@ public:
     Process(QObject *parent = 0);
     void setBufferedOutput(bool bufferedOutput);
     bool isBufferedOutputSet() const;
-    void setEnvironment(const ProcessEnvironment &e);
-    ProcessEnvironment environment() const;
+    void setLineOutput(bool lineOutput);
+    bool isLineOutputSet() const { return m_lineOutput; }
+    void setOutputLinePrefix(const QByteArray &) {}
+    void setOutputMemoryLimit(qint64) {}
+    void setOutputCapture(bool) {}
+    bool isOutputCaptureSet() const { return false; }
+    void flushBufferedOutput(QIODevice *, bool) {}
+    void takeBufferedOutput(OutputBuffer &) {}
+    void setEnvironment(const SharedProcessEnvironment *environment);
+    const SharedProcessEnvironment *environment() const { return m_environment; }
     bool isRunning() const;
     void start(const QString &commandLine);
     void writeToStdOutBuffer(const QByteArray &output);
     void writeToStdErrBuffer(const QByteArray &output);
     ExitStatus exitStatus() const;
+    const ProcessResourceUsage &resourceUsage() const { return m_resourceUsage; }
 
 signals:
     void error(Process::ProcessError);
@@ -71,6 +122,13 @@ signals:
 private slots:
     void forwardError(QProcess::ProcessError);
     void forwardFinished(int, QProcess::ExitStatus);
+
+private:
+    const SharedProcessEnvironment *m_environment;
+    uint m_environmentVersion;
+    ProcessResourceUsage m_resourceUsage;
+    QElapsedTimer m_runtime;
+    bool m_lineOutput;
 };
 
 } // namespace NMakeFile
@@ -108,15 +166,24 @@ public:
 
     void setBufferedOutput(bool b);
     bool isBufferedOutputSet() const { return m_bufferedOutput; }
+    void setLineOutput(bool b);
+    bool isLineOutputSet() const { return m_lineOutput; }
+    void setOutputLinePrefix(const QByteArray &prefix);
+    void setOutputMemoryLimit(qint64 limit);
+    void setOutputCapture(bool b) { m_outputCapture = b; }
+    bool isOutputCaptureSet() const { return m_outputCapture; }
+    void flushBufferedOutput(QIODevice *logFile, bool printToConsole);
+    void takeBufferedOutput(OutputBuffer &output);
     void writeToStdOutBuffer(const QByteArray &output);
     void writeToStdErrBuffer(const QByteArray &output);
     void setWorkingDirectory(const QString &path);
     const QString &workingDirectory() const { return m_workingDirectory; }
-    void setEnvironment(const ProcessEnvironment &environment);
-    const ProcessEnvironment &environment() const { return m_environment; }
+    void setEnvironment(const SharedProcessEnvironment *environment);
+    const SharedProcessEnvironment *environment() const { return m_environment; }
     int exitCode() const { return m_exitCode; }
     ExitStatus exitStatus() const { return m_exitStatus; }
     bool isRunning() const { return m_state == Running; }
+    const ProcessResourceUsage &resourceUsage() const { return m_resourceUsage; }
 
 signals:
     void error(Process::ProcessError);
@@ -128,6 +195,7 @@ public slots:
 
 private:
     void printBufferedOutput();
+    void retrieveResourceUsage();
 
 private slots:
     void tryToRetrieveExitCode();
@@ -136,12 +204,16 @@ private slots:
 private:
     class ProcessPrivate *d;
     QString m_workingDirectory;
-    ProcessEnvironment m_environment;
+    const SharedProcessEnvironment *m_environment;
     QByteArray m_envBlock;
+    uint m_envBlockVersion;
     ProcessState m_state;
     int m_exitCode;
     ExitStatus m_exitStatus;
+    ProcessResourceUsage m_resourceUsage;
     bool m_bufferedOutput;
+    bool m_lineOutput;
+    bool m_outputCapture;
 
     friend class ProcessPrivate;
 };
@@ -24,12 +24,16 @@
 ****************************************************************************/
 
 #include "jomprocess.h"
+#include "consolewriter.h"
 #include <cstdio>
 
 namespace NMakeFile {
 
 Process::Process(QObject *parent)
     : QProcess(parent)
+    , m_environment(0)
+    , m_environmentVersion(0)
+    , m_lineOutput(false)
 {
     connect(this, SIGNAL(error(QProcess::ProcessError)), SLOT(forwardError(QProcess::ProcessError)));
     connect(this, SIGNAL(finished(int, QProcess::ExitStatus)), SLOT(forwardFinished(int, QProcess::ExitStatus)));
@@ -45,21 +49,17 @@ bool Process::isBufferedOutputSet() const
     return QProcess::processChannelMode() == SeparateChannels;
 }
 
-void Process::setEnvironment(const ProcessEnvironment &e)
+void Process::setLineOutput(bool lineOutput)
 {
-    QProcessEnvironment qpenv;
-    for (ProcessEnvironment::const_iterator it = e.constBegin(); it != e.constEnd(); ++it)
-        qpenv.insert(it.key().toQString(), it.value());
-    QProcess::setProcessEnvironment(qpenv);
+    // QProcess cannot prefix the output lines. Forward the output directly instead.
+    m_lineOutput = lineOutput;
+    setBufferedOutput(!lineOutput);
 }
 
-ProcessEnvironment Process::environment() const
+void Process::setEnvironment(const SharedProcessEnvironment *environment)
 {
-    ProcessEnvironment env;
-    const QProcessEnvironment qpenv = QProcess::processEnvironment();
-    foreach (const QString &key, qpenv.keys())
-        env.insert(key, qpenv.value(key));
-    return env;
+    m_environment = environment;
+    m_environmentVersion = 0;
 }
 
 bool Process::isRunning() const
@@ -69,20 +69,28 @@ bool Process::isRunning() const
 
 void Process::start(const QString &commandLine)
 {
+    if (m_environment && m_environmentVersion != m_environment->version()) {
+        const ProcessEnvironment &e = m_environment->environment();
+        QProcessEnvironment qpenv;
+        for (ProcessEnvironment::const_iterator it = e.constBegin(); it != e.constEnd(); ++it)
+            qpenv.insert(it.key().toQString(), it.value());
+        QProcess::setProcessEnvironment(qpenv);
+        m_environmentVersion = m_environment->version();
+    }
+    m_resourceUsage = ProcessResourceUsage();
+    m_runtime.start();
     QProcess::start(commandLine);
     QProcess::waitForStarted();
 }
 
 void Process::writeToStdOutBuffer(const QByteArray &output)
 {
-    fputs(output.data(), stdout);
-    fflush(stdout);
+    ConsoleWriter::instance()->write(stdout, output, ConsoleWriter::TextMode);
 }
 
 void Process::writeToStdErrBuffer(const QByteArray &output)
 {
-    fputs(output.data(), stderr);
-    fflush(stderr);
+    ConsoleWriter::instance()->write(stderr, output, ConsoleWriter::TextMode);
 }
 
 Process::ExitStatus Process::exitStatus() const
@@ -108,6 +116,8 @@ void Process::forwardError(QProcess::ProcessError qe)
 
 void Process::forwardFinished(int exitCode, QProcess::ExitStatus status)
 {
+    // QProcess does not provide more than the wall time.
+    m_resourceUsage.wallTime = m_runtime.elapsed();
     emit finished(exitCode, static_cast<Process::ExitStatus>(status));
 }
 
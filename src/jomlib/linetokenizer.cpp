@@ -0,0 +1,231 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "linetokenizer.h"
+
+namespace NMakeFile {
+
+/**
+ * Returns true for the characters that \w matches in QRegExp.
+ */
+static inline bool isWordChar(const QChar &ch)
+{
+    return ch.isLetterOrNumber() || ch.isMark() || ch == QLatin1Char('_');
+}
+
+static int skipWhiteSpace(const QString &str, int pos)
+{
+    while (pos < str.length() && str.at(pos).isSpace())
+        ++pos;
+    return pos;
+}
+
+/**
+ * Returns the start of the extension (\.\w+) that ends at end or -1.
+ */
+static int extensionStart(const QString &str, int end)
+{
+    int i = end;
+    while (i > 0 && isWordChar(str.at(i - 1)))
+        --i;
+    if (i == end || i == 0 || str.at(i - 1) != QLatin1Char('.'))
+        return -1;
+    return i - 1;
+}
+
+/**
+ * Matches (\{.*\})?(\.\w+) against str.left(end).
+ */
+static bool matchFromPart(const QString &str, int end, LineTokenizer::Tokens *tokens)
+{
+    const int extStart = extensionStart(str, end);
+    if (extStart < 0)
+        return false;
+    if (extStart > 0) {
+        if (extStart < 2 || str.at(0) != QLatin1Char('{')
+                || str.at(extStart - 1) != QLatin1Char('}')) {
+            return false;
+        }
+        tokens->fromSearchPath = str.mid(1, extStart - 2);
+    } else {
+        tokens->fromSearchPath.clear();
+    }
+    tokens->fromExtension = str.mid(extStart, end - extStart);
+    return true;
+}
+
+/**
+ * Determines the type of the (macro expanded) line in one pass over its first
+ * characters. Fills tokens for dot directives and inference rules.
+ */
+LineTokenizer::LineType LineTokenizer::classify(const QString &line, Tokens *tokens)
+{
+    const int pos = skipWhiteSpace(line, 0);
+    if (pos == line.length())
+        return EmptyLine;
+    if (pos > 0)
+        return OtherLine;
+
+    const QChar firstChar = line.at(0);
+    if (firstChar == QLatin1Char('.')) {
+        if (isDotDirective(line, tokens))
+            return DotDirectiveLine;
+        if (isInferenceRule(line, tokens))
+            return InferenceRuleLine;
+    } else if (firstChar == QLatin1Char('{')) {
+        if (isInferenceRule(line, tokens))
+            return InferenceRuleLine;
+    }
+    return OtherLine;
+}
+
+/**
+ * Matches ^\.(IGNORE|PRECIOUS|RESPONSEFILES|SILENT|SUFFIXES)\s*:(.*)
+ */
+bool LineTokenizer::isDotDirective(const QString &line, Tokens *tokens)
+{
+    static const char * const directives[] = {
+        "IGNORE", "PRECIOUS", "RESPONSEFILES", "SILENT", "SUFFIXES"
+    };
+
+    if (!line.startsWith(QLatin1Char('.')))
+        return false;
+
+    for (size_t i = 0; i < sizeof(directives) / sizeof(directives[0]); ++i) {
+        const QLatin1String directive(directives[i]);
+        if (line.midRef(1, directive.size()) != directive)
+            continue;
+        const int colonPos = skipWhiteSpace(line, directive.size() + 1);
+        if (colonPos == line.length() || line.at(colonPos) != QLatin1Char(':'))
+            return false;
+        tokens->directive = directive;
+        tokens->value = line.mid(colonPos + 1);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Matches ^(\{.*\})?(\.\w+)(\{.*\})?(\.\w+)(:{1,2})$
+ *
+ * The line is scanned from the end, because the extensions and colons are
+ * fixed there, while the search paths may contain any character.
+ */
+bool LineTokenizer::isInferenceRule(const QString &line, Tokens *tokens)
+{
+    int end = line.length();
+    while (end > 0 && line.at(end - 1) == QLatin1Char(':'))
+        --end;
+    const int colonCount = line.length() - end;
+    if (colonCount < 1 || colonCount > 2)
+        return false;
+
+    const int toExtStart = extensionStart(line, end);
+    if (toExtStart <= 0)
+        return false;
+
+    if (line.at(toExtStart - 1) == QLatin1Char('}')) {
+        // The target search path starts at one of the opening braces.
+        // Like the greedy regular expression, prefer the rightmost one.
+        for (int i = toExtStart - 2; i > 0; --i) {
+            if (line.at(i) != QLatin1Char('{') || !matchFromPart(line, i, tokens))
+                continue;
+            tokens->toSearchPath = line.mid(i + 1, toExtStart - i - 2);
+            tokens->toExtension = line.mid(toExtStart, end - toExtStart);
+            tokens->batchMode = colonCount == 2;
+            return true;
+        }
+        return false;
+    }
+
+    if (!matchFromPart(line, toExtStart, tokens))
+        return false;
+    tokens->toSearchPath.clear();
+    tokens->toExtension = line.mid(toExtStart, end - toExtStart);
+    tokens->batchMode = colonCount == 2;
+    return true;
+}
+
+/**
+ * Matches ^!\s*(\S+)(.*) and returns the upper case directive and the trimmed value.
+ * "!else if", "!else ifdef" and "!else ifndef" are returned as ELSEIF, ELSEIFDEF
+ * and ELSEIFNDEF.
+ */
+bool LineTokenizer::isPreprocessingDirective(const QString &line, QString *directive,
+                                             QString *value)
+{
+    if (!line.startsWith(QLatin1Char('!')))
+        return false;
+
+    const int directiveStart = skipWhiteSpace(line, 1);
+    int directiveEnd = directiveStart;
+    while (directiveEnd < line.length() && !line.at(directiveEnd).isSpace())
+        ++directiveEnd;
+    if (directiveEnd == directiveStart)
+        return false;
+
+    *directive = line.mid(directiveStart, directiveEnd - directiveStart).toUpper();
+    *value = line.mid(directiveEnd).trimmed();
+
+    if (*directive == QLatin1String("ELSE")) {
+        // Matches ^(ifn?def|if)\s+(.*)$ case-insensitively.
+        static const char * const conditionals[] = { "ifdef", "ifndef", "if" };
+        for (size_t i = 0; i < sizeof(conditionals) / sizeof(conditionals[0]); ++i) {
+            const QLatin1String conditional(conditionals[i]);
+            const int len = conditional.size();
+            if (value->length() > len && value->at(len).isSpace()
+                    && value->startsWith(conditional, Qt::CaseInsensitive)) {
+                directive->append(QString(conditional).toUpper());
+                *value = value->mid(skipWhiteSpace(*value, len));
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Splits the string at white space and drops the empty parts.
+ */
+QStringList LineTokenizer::splitAtWhiteSpace(const QString &str)
+{
+    QStringList result;
+    int start = -1;
+    for (int i = 0; i < str.length(); ++i) {
+        if (str.at(i).isSpace()) {
+            if (start >= 0) {
+                result.append(str.mid(start, i - start));
+                start = -1;
+            }
+        } else if (start < 0) {
+            start = i;
+        }
+    }
+    if (start >= 0)
+        result.append(str.mid(start));
+    return result;
+}
+
+} // namespace NMakeFile
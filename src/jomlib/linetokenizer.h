@@ -0,0 +1,73 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef LINETOKENIZER_H
+#define LINETOKENIZER_H
+
+#include <QtCore/QStringList>
+
+namespace NMakeFile {
+
+/**
+ * Classifies and splits makefile lines for the parser and the preprocessor.
+ *
+ * This is a hand-written replacement for the regular expressions that were
+ * used before. Every function scans the line once and behaves like the
+ * regular expression that is noted in its documentation.
+ */
+class LineTokenizer
+{
+public:
+    enum LineType
+    {
+        EmptyLine,
+        DotDirectiveLine,
+        InferenceRuleLine,
+        OtherLine
+    };
+
+    struct Tokens
+    {
+        Tokens() : batchMode(false) {}
+
+        QString directive;          // dot directive name without the dot
+        QString value;              // dot directive value
+        QString fromSearchPath;     // inference rule search paths without the braces
+        QString fromExtension;
+        QString toSearchPath;
+        QString toExtension;
+        bool batchMode;
+    };
+
+    static LineType classify(const QString &line, Tokens *tokens);
+    static bool isDotDirective(const QString &line, Tokens *tokens);
+    static bool isInferenceRule(const QString &line, Tokens *tokens);
+    static bool isPreprocessingDirective(const QString &line, QString *directive, QString *value);
+    static QStringList splitAtWhiteSpace(const QString &str);
+};
+
+} // namespace NMakeFile
+
+#endif // LINETOKENIZER_H
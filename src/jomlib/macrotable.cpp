@@ -27,7 +27,6 @@
 #include "exception.h"
 
 #include <QStringList>
-#include <QRegExp>
 #include <QDebug>
 
 namespace NMakeFile {
@@ -105,15 +104,21 @@ void MacroTable::defineCommandLineMacroValueImpl(const QString &name, const QStr
     macroData->isReadOnly = true;
 }
 
-bool MacroTable::isMacroNameValid(const QString& name) const
+/**
+ * A valid macro name consists of word characters and dots.
+ */
+bool MacroTable::isMacroNameValid(const QString& name)
 {
-    static QRegExp rexMacroIdentifier;
-    if (rexMacroIdentifier.isEmpty()) {
-        rexMacroIdentifier.setPattern(QLatin1String("([A-Z]|_|)(\\w|\\.)+"));
-        rexMacroIdentifier.setCaseSensitivity(Qt::CaseInsensitive);
+    if (name.isEmpty())
+        return false;
+    for (int i = 0; i < name.length(); ++i) {
+        const QChar ch = name.at(i);
+        if (!ch.isLetterOrNumber() && !ch.isMark() && ch != QLatin1Char('_')
+                && ch != QLatin1Char('.')) {
+            return false;
+        }
     }
-
-    return rexMacroIdentifier.exactMatch(name);
+    return true;
 }
 
 /**
@@ -226,6 +231,9 @@ QString MacroTable::expandMacros(const QString& str, bool inDependentsLine) cons
 
 QString MacroTable::expandMacros(const QString& str, bool inDependentsLine, QSet<QString>& usedMacros) const
 {
+    if (!str.contains(QLatin1Char('$')))
+        return str;
+
     QString ret;
     ret.reserve(str.count());
 
@@ -45,7 +45,7 @@ public:
     const ProcessEnvironment &environment() const { return m_environment; }
 
     bool isMacroDefined(const QString& name) const;
-    bool isMacroNameValid(const QString& name) const;
+    static bool isMacroNameValid(const QString& name);
     QString macroValue(const QString& macroName) const;
     void defineEnvironmentMacroValue(const QString& name, const QString& value, bool readOnly = false);
     void defineCommandLineMacroValue(const QString &name, const QString &value);
@@ -70,6 +70,8 @@ public:
     static void applySubstitution(const Substitution &substitution, QString &value);
 
 private:
+    friend class MakefileCache;
+
     enum class MacroSource
     {
         CommandLine,
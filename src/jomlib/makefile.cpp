@@ -25,6 +25,8 @@
 
 #include "makefile.h"
 #include "exception.h"
+#include "fastfileinfo.h"
+#include "helperfunctions.h"
 #include "options.h"
 
 #include <QFileInfo>
@@ -117,7 +119,8 @@ DescriptionBlock::DescriptionBlock(Makefile* mkfile)
     m_bNoCyclesRootedHere(false),
     m_bInferenceRulesPreselected(false),
     m_canAddCommands(ACSUnknown),
-    m_pMakefile(mkfile)
+    m_pMakefile(mkfile),
+    m_dependentTargetsGeneration(0)
 {
 }
 
@@ -126,6 +129,35 @@ void DescriptionBlock::setTargetName(const QString& name)
     m_targetName = name;
 }
 
+/**
+ * Returns the targets of the dependents in the order of m_dependents.
+ * Dependents that are no targets of the makefile are null.
+ *
+ * The lookups are done once and cached. New targets in the makefile
+ * invalidate the cache. Dependents may be appended to m_dependents, or
+ * m_dependents may be restored to a shorter state, without invalidating the
+ * cache. Other changes to m_dependents must call invalidateDependentTargets().
+ */
+const QVector<DescriptionBlock*>& DescriptionBlock::dependentTargets()
+{
+    const uint generation = m_pMakefile->targetsGeneration();
+    if (m_dependentTargetsGeneration != generation) {
+        m_dependentTargets.clear();
+        m_dependentTargetsGeneration = generation;
+    }
+
+    if (m_dependentTargets.count() > m_dependents.count())
+        m_dependentTargets.resize(m_dependents.count());
+    for (int i = m_dependentTargets.count(); i < m_dependents.count(); ++i)
+        m_dependentTargets.append(m_pMakefile->target(m_dependents.at(i)));
+    return m_dependentTargets;
+}
+
+void DescriptionBlock::invalidateDependentTargets()
+{
+    m_dependentTargets.clear();
+}
+
 /**
  * Expands the following macros for the dependents of this target.
  */
@@ -136,10 +168,26 @@ void DescriptionBlock::expandFileNameMacrosForDependents()
         QString& dependent = *it;
         expandFileNameMacros(dependent, -1, true);
     }
+    invalidateDependentTargets();
 }
 
 void DescriptionBlock::expandFileNameMacros()
 {
+    if (!m_inferredDependents.isEmpty()) {
+        // The commands are still shared with the inference rule's template.
+        // Detaching them here creates this target's own instance.
+        const QString fileNameMacroString = MacroTable::fileNameMacroMagicEscape + QLatin1Char('<');
+        QList<Command>::iterator it = m_commands.begin();
+        QList<Command>::iterator itEnd = m_commands.end();
+        for (; it != itEnd; ++it) {
+            Command& command = *it;
+            foreach (InlineFile* inlineFile, command.m_inlineFiles)
+                inlineFile->m_content.replace(fileNameMacroString, m_inferredDependents);
+            command.m_commandLine.replace(fileNameMacroString, m_inferredDependents);
+        }
+        m_inferredDependents.clear();
+    }
+
     QList<Command>::iterator it = m_commands.begin();
     while (it != m_commands.end()) {
         if ((*it).m_singleExecution) {
@@ -408,8 +456,10 @@ QString InferenceRule::inferredDependent(const QString &targetName) const
 Makefile::Makefile(const QString &fileName)
 :   m_fileName(fileName),
     m_firstTarget(0),
+    m_targetsGeneration(0),
     m_macroTable(0),
     m_options(0),
+    m_useDirectoryListings(false),
     m_parallelExecutionDisabled(false)
 {
 }
@@ -430,8 +480,11 @@ void Makefile::clear()
 
     m_firstTarget = 0;
     m_targets.clear();
+    ++m_targetsGeneration;
     m_preciousTargets.clear();
+    m_responseFileTools.clear();
     m_inferenceRules.clear();
+    m_inferenceRuleCommands.clear();
 }
 
 const QString &Makefile::dirPath() const
@@ -497,8 +550,7 @@ void Makefile::dumpInferenceRules() const
 
 void Makefile::filterRulesByDependent(QVector<InferenceRule*>& rules, const QString& targetName)
 {
-    QFileInfo fi(targetName);
-    QString targetFileName = fi.fileName();
+    const QString targetFileName = fileNameFromFilePath(targetName);
 
     QVector<InferenceRule*>::iterator it = rules.begin();
     while (it != rules.end()) {
@@ -506,42 +558,147 @@ void Makefile::filterRulesByDependent(QVector<InferenceRule*>& rules, const QStr
 
         // Thanks to Parser::preselectInferenceRules the target name
         // is guaranteed to end with rule->m_toExtension.
-        QString baseName = targetFileName;
-        baseName.chop(rule->m_toExtension.length());
-        QString dependentName = rule->m_fromSearchPath + QDir::separator() +
-                                baseName + rule->m_fromExtension;
+        QString dependentFileName = targetFileName;
+        dependentFileName.chop(rule->m_toExtension.length());
+        dependentFileName += rule->m_fromExtension;
+        const QString dependentName = rule->m_fromSearchPath + QDir::separator() + dependentFileName;
 
         DescriptionBlock* depTarget = m_targets.value(dependentName);
-        if ((depTarget && depTarget->m_bFileExists) || QFile::exists(dependentName)) {
+        if ((depTarget && depTarget->m_bFileExists)
+                || fileExistsInDirectory(rule->m_fromSearchPath, dependentFileName)) {
             ++it;
             continue;
         }
 
         it = rules.erase(it);
-    }    
+    }
+}
+
+/**
+ * Checks if a file exists in a directory.
+ * If many targets are passed to applyInferenceRules(), the directory is read
+ * once per call. Checking the source files of thousands of targets doesn't hit
+ * the file system for each target then. Few targets are checked one by one,
+ * because reading a large directory costs more than a handful of lookups.
+ */
+bool Makefile::fileExistsInDirectory(const QString& directory, const QString& fileName)
+{
+    if (!m_useDirectoryListings)
+        return QFile::exists(directory + QDir::separator() + fileName);
+
+    QHash<QString, QSet<QString> >::iterator it = m_directoryListingCache.find(directory);
+    if (it == m_directoryListingCache.end()) {
+        QSet<QString> entries;
+        const QDir::Filters filters = QDir::AllEntries | QDir::NoDotAndDotDot
+                                      | QDir::Hidden | QDir::System;
+        foreach (const QString &entry, QDir(directory).entryList(filters, QDir::Unsorted))
+            entries.insert(entry.toLower());
+        it = m_directoryListingCache.insert(directory, entries);
+    }
+    return it.value().contains(fileName.toLower());
 }
 
-void Makefile::applyInferenceRules(QList<DescriptionBlock*> targets)
+/**
+ * Applies the matching inference rules to the targets.
+ *
+ * Targets of batch-mode rules are collected and built in batches. If
+ * mayDeferBatches is true and a batch window is set (/BATCHWINDOW), the
+ * batches are formed when the window has elapsed since the first target was
+ * collected. Targets that show up within the window join the same batches.
+ * Until then, isPendingBatchModeTarget() returns true for the collected targets.
+ */
+void Makefile::applyInferenceRules(QList<DescriptionBlock*> targets, bool mayDeferBatches)
 {
+    // The number of targets from which on reading the source directories pays off.
+    static const int minTargetsForDirectoryListings = 32;
+
+    m_useDirectoryListings = targets.count() >= minTargetsForDirectoryListings;
     foreach (DescriptionBlock *t, targets)
         applyInferenceRules(t);
+    m_directoryListingCache.clear();
+    m_useDirectoryListings = false;
 
     if (!m_batchModeTargets.isEmpty()) {
+        if (mayDeferBatches && m_options->batchWindow > 0) {
+            if (!m_batchWindowTimer.isValid())
+                m_batchWindowTimer.start();
+            if (m_batchWindowTimer.elapsed() < m_options->batchWindow)
+                return;
+        }
+        m_batchWindowTimer.invalidate();
+
         foreach (const InferenceRule *rule, m_batchModeRules) {
+            // QMultiHash returns the values in reverse insertion order.
             QList<DescriptionBlock*> allBatchTargets = m_batchModeTargets.values(rule);
-            int filesPerBatch = qMax(1, qRound(float(allBatchTargets.count()) / float(g_options.maxNumberOfJobs)));
-            do {
-                QList<DescriptionBlock*> batch;
-                for (int i=0; i < filesPerBatch && !allBatchTargets.isEmpty(); ++i)
-                    batch.append( allBatchTargets.takeFirst() );
+            std::reverse(allBatchTargets.begin(), allBatchTargets.end());
+
+            // The size of the source file is the estimated cost of building a target.
+            QVector<qint64> costs;
+            costs.reserve(allBatchTargets.count());
+            foreach (DescriptionBlock *target, allBatchTargets)
+                costs.append(FastFileInfo(rule->inferredDependent(target->targetName())).size());
+
+            foreach (int batchSize, batchSizes(costs, g_options.maxNumberOfJobs)) {
+                QList<DescriptionBlock*> batch = allBatchTargets.mid(0, batchSize);
+                allBatchTargets.erase(allBatchTargets.begin(), allBatchTargets.begin() + batchSize);
                 applyInferenceRule(batch, rule);
-            } while (!allBatchTargets.isEmpty());
+            }
         }
         m_batchModeRules.clear();
         m_batchModeTargets.clear();
+        m_pendingBatchModeTargets.clear();
     }
 }
 
+/**
+ * Returns the time in milliseconds until the pending batch-mode targets
+ * are put into batches.
+ */
+int Makefile::remainingBatchWindowTime() const
+{
+    if (!m_batchWindowTimer.isValid())
+        return m_options->batchWindow;
+    return int(qMax(qint64(0), m_options->batchWindow - m_batchWindowTimer.elapsed()));
+}
+
+/**
+ * Splits a sequence of files with the given costs into batches for at most
+ * slotCount parallel jobs and returns the number of files per batch.
+ *
+ * The batches get smaller towards the end of the sequence (guided
+ * self-scheduling). Every batch gets the remaining cost divided by the number
+ * of slots, but not less than a quarter of the even share. The first batches
+ * keep all slots busy, the small batches at the end fill the gaps, so that all
+ * jobs finish at about the same time. Batches are built in the order in which
+ * they are handed out.
+ */
+QVector<int> Makefile::batchSizes(const QVector<qint64> &costs, int slotCount)
+{
+    // Every file has a fixed cost for opening it, writing the output and so on.
+    const qint64 fixedCostPerFile = 4096;
+
+    slotCount = qMax(1, slotCount);
+    qint64 remainingCost = 0;
+    foreach (qint64 cost, costs)
+        remainingCost += cost + fixedCostPerFile;
+    const qint64 minimumBatchCost = remainingCost / (4 * slotCount);
+
+    QVector<int> result;
+    int i = 0;
+    while (i < costs.count()) {
+        const qint64 batchCost = qMax(remainingCost / slotCount, minimumBatchCost);
+        qint64 cost = 0;
+        int count = 0;
+        do {
+            cost += costs.at(i++) + fixedCostPerFile;
+            ++count;
+        } while (i < costs.count() && cost < batchCost);
+        remainingCost -= cost;
+        result.append(count);
+    }
+    return result;
+}
+
 static bool infRulesPriorityGreaterThan(const InferenceRule *lhs, const InferenceRule *rhs)
 {
     return lhs->m_priority > rhs->m_priority;
@@ -551,6 +708,7 @@ void Makefile::addInferenceRule(InferenceRule *rule)
 {
     m_inferenceRules.removeOne(rule);
     m_inferenceRules.append(rule);
+    m_inferenceRuleCommands.remove(rule);
 }
 
 void Makefile::calculateInferenceRulePriorities(const QStringList &suffixes)
@@ -574,6 +732,42 @@ void Makefile::addPreciousTarget(const QString& targetName)
         m_preciousTargets.append(targetName);
 }
 
+static QString normalizedToolName(const QString &toolName)
+{
+    QString result = fileNameFromFilePath(toolName).toLower();
+    if (result.endsWith(QLatin1String(".exe")))
+        result.chop(4);
+    return result;
+}
+
+/**
+ * Adds a tool that accepts @file response files.
+ * Tools are listed in the makefile with the .RESPONSEFILES directive.
+ */
+void Makefile::addResponseFileTool(const QString& toolName)
+{
+    const QString name = normalizedToolName(toolName);
+    if (!m_responseFileTools.contains(name))
+        m_responseFileTools.append(name);
+}
+
+/**
+ * Returns true, if the tool is known to accept @file response files.
+ * toolName may contain a path and the .exe extension.
+ */
+bool Makefile::acceptsResponseFile(const QString& toolName) const
+{
+    static const char * const knownTools[] = {
+        "cl", "clang-cl", "lib", "link", "lld-link", "midl", "ml", "ml64", "moc"
+    };
+
+    const QString name = normalizedToolName(toolName);
+    for (size_t i = 0; i < sizeof(knownTools) / sizeof(knownTools[0]); ++i)
+        if (name == QLatin1String(knownTools[i]))
+            return true;
+    return m_responseFileTools.contains(name);
+}
+
 void Makefile::invalidateTimeStamps()
 {
     QHash<QString, DescriptionBlock*>::iterator it = m_targets.begin();
@@ -610,6 +804,7 @@ void Makefile::applyInferenceRule(DescriptionBlock* target, const InferenceRule*
     if (!applyingBatchMode && m_options->batchModeEnabled && rule->m_batchMode) {
         m_batchModeRules.insert(rule);
         m_batchModeTargets.insert(rule, target);
+        m_pendingBatchModeTargets.insert(target);
         return;
     }
 
@@ -619,53 +814,57 @@ void Makefile::applyInferenceRule(DescriptionBlock* target, const InferenceRule*
     QString inferredDependent = rule->inferredDependent(target->targetName());
     if (!target->m_dependents.contains(inferredDependent))
         target->m_dependents.append(inferredDependent);
-    target->m_commands = rule->m_commands;
+    target->m_commands = inferenceRuleCommands(rule);
+    target->m_inferredDependents = inferredDependent;
 
     //qDebug() << "----> inferredDependent:" << inferredDependent;
-
-    const QString fileNameMacroString = MacroTable::fileNameMacroMagicEscape + QLatin1Char('<');
-    QList<Command>::iterator it = target->m_commands.begin();
-    QList<Command>::iterator itEnd = target->m_commands.end();
-    for (; it != itEnd; ++it) {
-        Command& command = *it;
-        foreach (InlineFile* inlineFile, command.m_inlineFiles) {
-            inlineFile->m_content = m_macroTable->expandMacros(inlineFile->m_content);
-            inlineFile->m_content.replace(fileNameMacroString, inferredDependent);
-        }
-        command.m_commandLine = m_macroTable->expandMacros(command.m_commandLine);
-        command.evaluateModifiers();
-        command.m_commandLine.replace(fileNameMacroString, inferredDependent);
-    }
 }
 
 void Makefile::applyInferenceRule(QList<DescriptionBlock*> &batch, const InferenceRule *rule)
 {
     QString inferredDependents;
     DescriptionBlock *executingTarget = batch.first();
+    QSet<QString> dependentSet = executingTarget->m_dependents.toSet();
     foreach (DescriptionBlock *target, batch) {
         target->m_inferenceRules.clear();
         QString inferredDependent = rule->inferredDependent(target->targetName());
-        if (!executingTarget->m_dependents.contains(inferredDependent))
+        if (!dependentSet.contains(inferredDependent)) {
+            dependentSet.insert(inferredDependent);
             executingTarget->m_dependents.append(inferredDependent);
+        }
 
         inferredDependents.append(inferredDependent);
         inferredDependents.append(QLatin1Char(' '));
     }
 
-    executingTarget->m_commands = rule->m_commands;
-    QList<Command>::iterator it = executingTarget->m_commands.begin();
-    QList<Command>::iterator itEnd = executingTarget->m_commands.end();
-    const QString fileNameMacroString = MacroTable::fileNameMacroMagicEscape + QLatin1Char('<');
-    for (; it != itEnd; ++it) {
-        Command& command = *it;
-        foreach (InlineFile* inlineFile, command.m_inlineFiles) {
+    executingTarget->m_commands = inferenceRuleCommands(rule);
+    executingTarget->m_inferredDependents = inferredDependents;
+}
+
+/**
+ * Returns the commands of the inference rule with all macros expanded.
+ *
+ * The macro table does not change after parsing, so the expansion is done once per rule.
+ * The targets share the returned list until they are dispatched. Then
+ * DescriptionBlock::expandFileNameMacros() creates the per-target commands.
+ */
+const QList<Command> &Makefile::inferenceRuleCommands(const InferenceRule *rule)
+{
+    QHash<const InferenceRule*, QList<Command> >::iterator it = m_inferenceRuleCommands.find(rule);
+    if (it != m_inferenceRuleCommands.end())
+        return it.value();
+
+    QList<Command> commands = rule->m_commands;
+    QList<Command>::iterator cmdIt = commands.begin();
+    QList<Command>::iterator cmdItEnd = commands.end();
+    for (; cmdIt != cmdItEnd; ++cmdIt) {
+        Command& command = *cmdIt;
+        foreach (InlineFile* inlineFile, command.m_inlineFiles)
             inlineFile->m_content = m_macroTable->expandMacros(inlineFile->m_content);
-            inlineFile->m_content.replace(fileNameMacroString, inferredDependents);
-        }
         command.m_commandLine = m_macroTable->expandMacros(command.m_commandLine);
         command.evaluateModifiers();
-        command.m_commandLine.replace(fileNameMacroString, inferredDependents);
     }
+    return m_inferenceRuleCommands.insert(rule, commands).value();
 }
 
 } // namespace NMakeFile
@@ -29,6 +29,7 @@
 #include "fastfileinfo.h"
 #include "macrotable.h"
 #include <QStringList>
+#include <QElapsedTimer>
 #include <QHash>
 #include <QVector>
 
@@ -99,6 +100,9 @@ public:
      */
     Makefile* makefile() const { return m_pMakefile; }
 
+    const QVector<DescriptionBlock*>& dependentTargets();
+    void invalidateDependentTargets();
+
     QStringList m_dependents;
     FileTime m_timeStamp;
     bool m_bFileExists;
@@ -106,6 +110,7 @@ public:
     bool m_bNoCyclesRootedHere;
     bool m_bInferenceRulesPreselected;
     QVector<InferenceRule*> m_inferenceRules;
+    QString m_inferredDependents;   // value of $< if the commands come from an inference rule
 
     enum AddCommandsState { ACSUnknown, ACSEnabled, ACSDisabled };
     AddCommandsState m_canAddCommands;
@@ -119,6 +124,8 @@ private:
 private:
     QString m_targetName;
     Makefile* m_pMakefile;
+    QVector<DescriptionBlock*> m_dependentTargets;
+    uint m_dependentTargetsGeneration;
 };
 
 class InferenceRule : public CommandContainer {
@@ -150,9 +157,18 @@ public:
     {
         m_targets[target->targetName().toLower()] = target;
         if (!m_firstTarget) m_firstTarget = target;
+        ++m_targetsGeneration;
+    }
+
+    /**
+     * Returns a number that changes whenever targets are added or removed.
+     */
+    uint targetsGeneration() const
+    {
+        return m_targetsGeneration;
     }
 
-    DescriptionBlock* firstTarget()
+    DescriptionBlock* firstTarget() const
     {
         return m_firstTarget;
     }
@@ -160,17 +176,12 @@ public:
     DescriptionBlock* target(const QString& name) const
     {
         DescriptionBlock* result = 0;
-        const QString lowerName = name.toLower();
+        QString lowerName = name.toLower();
         result = m_targets.value(lowerName, 0);
-        if (result)
+        if (result || !lowerName.contains(QLatin1Char('/')))
             return result;
 
-        QString systemName = lowerName;
-        result = m_targets.value(systemName.replace(QLatin1Char('/'), QLatin1Char('\\')), 0);
-        if (result)
-            return result;
-
-        return result;
+        return m_targets.value(lowerName.replace(QLatin1Char('/'), QLatin1Char('\\')), 0);
     }
 
     const QHash<QString, DescriptionBlock*>& targets() const
@@ -183,6 +194,11 @@ public:
         return m_preciousTargets;
     }
 
+    const QStringList& responseFileTools() const
+    {
+        return m_responseFileTools;
+    }
+
     const QVector<InferenceRule *>& inferenceRules() const
     {
         return m_inferenceRules;
@@ -202,29 +218,44 @@ public:
     void dumpTargets() const;
     void dumpInferenceRules() const;
     void invalidateTimeStamps();
-    void applyInferenceRules(QList<DescriptionBlock*> targets);
+    void applyInferenceRules(QList<DescriptionBlock*> targets, bool mayDeferBatches = false);
+    bool hasPendingBatchModeTargets() const { return !m_batchModeTargets.isEmpty(); }
+    bool isPendingBatchModeTarget(DescriptionBlock *target) const { return m_pendingBatchModeTargets.contains(target); }
+    int remainingBatchWindowTime() const;
     void addInferenceRule(InferenceRule *rule);
     void calculateInferenceRulePriorities(const QStringList &suffixes);
     void addPreciousTarget(const QString& targetName);
+    static QVector<int> batchSizes(const QVector<qint64> &costs, int slotCount);
+    void addResponseFileTool(const QString& toolName);
+    bool acceptsResponseFile(const QString& toolName) const;
 
 private:
     void filterRulesByDependent(QVector<InferenceRule*>& rules, const QString& targetName);
+    bool fileExistsInDirectory(const QString& directory, const QString& fileName);
     QStringList findInferredDependents(InferenceRule* rule, const QStringList& dependents);
     void applyInferenceRules(DescriptionBlock* target);
     void applyInferenceRule(DescriptionBlock* target, const InferenceRule *rule, bool applyingBatchMode = false);
     void applyInferenceRule(QList<DescriptionBlock*> &batch, const InferenceRule *rule);
+    const QList<Command> &inferenceRuleCommands(const InferenceRule *rule);
 
 private:
     QString m_fileName;
     mutable QString m_dirPath;
     DescriptionBlock* m_firstTarget;
     QHash<QString, DescriptionBlock*> m_targets;
+    uint m_targetsGeneration;
     QStringList m_preciousTargets;
+    QStringList m_responseFileTools;
     QVector<InferenceRule *> m_inferenceRules;
+    QHash<const InferenceRule*, QList<Command> > m_inferenceRuleCommands;
     MacroTable* m_macroTable;
     Options* m_options;
     QSet<const InferenceRule*> m_batchModeRules;
     QMultiHash<const InferenceRule*, DescriptionBlock*> m_batchModeTargets;
+    QSet<DescriptionBlock*> m_pendingBatchModeTargets;
+    QHash<QString, QSet<QString> > m_directoryListingCache;
+    bool m_useDirectoryListings;
+    QElapsedTimer m_batchWindowTimer;
     bool m_parallelExecutionDisabled;
 };
 
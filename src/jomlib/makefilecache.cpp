@@ -0,0 +1,385 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "makefilecache.h"
+#include "macrotable.h"
+#include "makefile.h"
+#include "options.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+
+#include <algorithm>
+
+namespace NMakeFile {
+
+static const quint32 cacheFileMagic = 0x4a4f4d43;   // "JOMC"
+static const quint32 cacheFormatVersion = 1;
+
+/**
+ * Variables that jom sets for its sub-processes.
+ * Their values change with every build. They are excluded from the cache key
+ * and the current values are restored after loading a snapshot.
+ */
+static const char * const volatileVariables[] = { "_JOMSRVKEY_", "_JOMJOBCOUNT_" };
+
+static bool isVolatileVariable(const QString &name)
+{
+    for (size_t i = 0; i < sizeof(volatileVariables) / sizeof(volatileVariables[0]); ++i)
+        if (name.compare(QLatin1String(volatileVariables[i]), Qt::CaseInsensitive) == 0)
+            return true;
+    return false;
+}
+
+static QByteArray fileHash(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!hash.addData(&file))
+        return QByteArray();
+    return hash.result();
+}
+
+static void writeCommands(QDataStream &stream, const QList<Command> &commands)
+{
+    stream << quint32(commands.count());
+    foreach (const Command &command, commands) {
+        stream << command.m_commandLine << quint32(command.m_maxExitCode)
+               << command.m_silent << command.m_singleExecution
+               << quint32(command.m_inlineFiles.count());
+        foreach (const InlineFile *inlineFile, command.m_inlineFiles) {
+            stream << inlineFile->m_keep << inlineFile->m_unicode
+                   << inlineFile->m_filename << inlineFile->m_content;
+        }
+    }
+}
+
+static void readCommands(QDataStream &stream, QList<Command> &commands)
+{
+    quint32 commandCount;
+    stream >> commandCount;
+    for (quint32 i = 0; i < commandCount && stream.status() == QDataStream::Ok; ++i) {
+        commands.append(Command());
+        Command &command = commands.last();
+        quint32 maxExitCode, inlineFileCount;
+        stream >> command.m_commandLine >> maxExitCode
+               >> command.m_silent >> command.m_singleExecution
+               >> inlineFileCount;
+        command.m_maxExitCode = maxExitCode;
+        for (quint32 k = 0; k < inlineFileCount && stream.status() == QDataStream::Ok; ++k) {
+            InlineFile *inlineFile = new InlineFile;
+            stream >> inlineFile->m_keep >> inlineFile->m_unicode
+                   >> inlineFile->m_filename >> inlineFile->m_content;
+            command.m_inlineFiles.append(inlineFile);
+        }
+    }
+}
+
+MakefileCache::MakefileCache(const QString &directory)
+    : m_directory(directory)
+{
+}
+
+/**
+ * Computes the cache key from everything that influences the parsing of the
+ * makefile except the content of the makefile and its include files.
+ * This includes the size and modification time of the jom executable.
+ */
+void MakefileCache::setKey(const QString &makefileName, const QStringList &activeTargets,
+                           const Options *options, const MacroTable *macroTable)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    // A different jom executable might parse the same makefile differently,
+    // even if it writes snapshots in the same format.
+    const QFileInfo executable(options->fullAppPath);
+    stream << cacheFormatVersion
+           << executable.size() << executable.lastModified()
+           << QFileInfo(makefileName).absoluteFilePath()
+           << activeTargets
+           << options->suppressOutputMessages
+           << options->stopOnErrors;
+
+    // QHash iteration order differs between processes.
+    QStringList macroNames = macroTable->m_macros.keys();
+    std::sort(macroNames.begin(), macroNames.end());
+    foreach (const QString &name, macroNames) {
+        if (isVolatileVariable(name))
+            continue;
+        const MacroTable::MacroData macroData = macroTable->m_macros.value(name);
+        stream << name << quint8(macroData.source) << macroData.isReadOnly << macroData.value;
+    }
+
+    const ProcessEnvironment &environment = macroTable->environment();
+    for (ProcessEnvironment::const_iterator it = environment.begin(); it != environment.end(); ++it) {
+        if (isVolatileVariable(it.key().toQString()))
+            continue;
+        stream << it.key().toQString() << it.value();
+    }
+
+    m_key = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+QString MakefileCache::fileName() const
+{
+    return m_directory + QLatin1Char('/') + QString::fromLatin1(m_key.toHex())
+            + QLatin1String(".jomcache");
+}
+
+/**
+ * Loads the snapshot for the current key into makefile and macroTable.
+ * Returns false, if there's no snapshot or if one of the makefiles it was
+ * created from has changed. Nothing is modified in that case.
+ */
+bool MakefileCache::load(Makefile *makefile, MacroTable *macroTable)
+{
+    m_recordedFiles.clear();
+    QFile file(fileName());
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    const QByteArray data = file.readAll();
+    file.close();
+
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, formatVersion;
+    QByteArray key;
+    stream >> magic >> formatVersion >> key;
+    if (stream.status() != QDataStream::Ok || magic != cacheFileMagic
+            || formatVersion != cacheFormatVersion || key != m_key)
+        return false;
+
+    // Record all files, even if one of them changed.
+    // The caller can prefetch them for parsing.
+    bool filesUnchanged = true;
+    quint32 fileCount;
+    stream >> fileCount;
+    for (quint32 i = 0; i < fileCount; ++i) {
+        QString filePath;
+        QByteArray hash;
+        stream >> filePath >> hash;
+        if (stream.status() != QDataStream::Ok)
+            return false;
+        m_recordedFiles.append(filePath);
+        if (filesUnchanged && fileHash(filePath) != hash)
+            filesUnchanged = false;
+    }
+    if (!filesUnchanged)
+        return false;
+
+    QStringList missingFiles;
+    stream >> missingFiles;
+    foreach (const QString &filePath, missingFiles)
+        if (QFileInfo::exists(filePath))
+            return false;
+
+    // macro table
+    QHash<QString, MacroTable::MacroData> macros;
+    quint32 macroCount;
+    stream >> macroCount;
+    for (quint32 i = 0; i < macroCount && stream.status() == QDataStream::Ok; ++i) {
+        QString name;
+        quint8 source;
+        MacroTable::MacroData macroData;
+        stream >> name >> source >> macroData.isReadOnly >> macroData.value;
+        macroData.source = static_cast<MacroTable::MacroSource>(source);
+        macros.insert(name, macroData);
+    }
+
+    ProcessEnvironment environment;
+    quint32 environmentCount;
+    stream >> environmentCount;
+    for (quint32 i = 0; i < environmentCount && stream.status() == QDataStream::Ok; ++i) {
+        QString name, value;
+        stream >> name >> value;
+        environment.insert(name, value);
+    }
+
+    // makefile properties and inference rules
+    bool parallelExecutionDisabled;
+    QStringList preciousTargets, responseFileTools;
+    stream >> parallelExecutionDisabled >> preciousTargets >> responseFileTools;
+
+    QVector<InferenceRule *> rules;
+    quint32 ruleCount;
+    stream >> ruleCount;
+    for (quint32 i = 0; i < ruleCount && stream.status() == QDataStream::Ok; ++i) {
+        InferenceRule *rule = new InferenceRule;
+        qint32 priority;
+        stream >> rule->m_batchMode >> rule->m_fromSearchPath >> rule->m_fromExtension
+               >> rule->m_toSearchPath >> rule->m_toExtension >> priority;
+        rule->m_priority = priority;
+        readCommands(stream, rule->m_commands);
+        rules.append(rule);
+    }
+
+    // targets
+    QString firstTargetKey;
+    quint32 targetCount;
+    stream >> firstTargetKey >> targetCount;
+    QList<DescriptionBlock *> targets;
+    DescriptionBlock *firstTarget = 0;
+    for (quint32 i = 0; i < targetCount && stream.status() == QDataStream::Ok; ++i) {
+        DescriptionBlock *target = new DescriptionBlock(makefile);
+        targets.append(target);
+        QString targetName;
+        qint8 canAddCommands;
+        QVector<qint32> ruleIndices;
+        stream >> targetName >> target->m_dependents;
+        readCommands(stream, target->m_commands);
+        stream >> target->m_bInferenceRulesPreselected >> canAddCommands >> ruleIndices;
+        target->setTargetName(targetName);
+        target->m_canAddCommands = static_cast<DescriptionBlock::AddCommandsState>(canAddCommands);
+        foreach (qint32 idx, ruleIndices) {
+            if (idx < 0 || idx >= rules.count()) {
+                stream.setStatus(QDataStream::ReadCorruptData);
+                break;
+            }
+            target->m_inferenceRules.append(rules.at(idx));
+        }
+        if (targetName.toLower() == firstTargetKey)
+            firstTarget = target;
+    }
+
+    if (stream.status() != QDataStream::Ok || (!firstTargetKey.isEmpty() && !firstTarget)) {
+        qDeleteAll(targets);
+        qDeleteAll(rules);
+        return false;
+    }
+
+    // Keep the current values of the volatile variables.
+    for (size_t i = 0; i < sizeof(volatileVariables) / sizeof(volatileVariables[0]); ++i) {
+        const QString name = QLatin1String(volatileVariables[i]);
+        macros.remove(name);
+        if (macroTable->m_macros.contains(name))
+            macros.insert(name, macroTable->m_macros.value(name));
+        environment.remove(name);
+        if (macroTable->m_environment.contains(name))
+            environment.insert(name, macroTable->m_environment.value(name));
+    }
+    macroTable->m_macros = macros;
+    macroTable->m_environment = environment;
+
+    makefile->setParallelExecutionDisabled(parallelExecutionDisabled);
+    foreach (const QString &targetName, preciousTargets)
+        makefile->addPreciousTarget(targetName);
+    foreach (const QString &toolName, responseFileTools)
+        makefile->addResponseFileTool(toolName);
+    foreach (InferenceRule *rule, rules)
+        makefile->addInferenceRule(rule);
+    if (firstTarget)
+        makefile->append(firstTarget);
+    foreach (DescriptionBlock *target, targets) {
+        if (target != firstTarget)
+            makefile->append(target);
+    }
+    return true;
+}
+
+/**
+ * Writes the snapshot of makefile and macroTable for the current key.
+ * files are the makefiles that were read, missingFiles are the include file
+ * candidates that did not exist.
+ */
+bool MakefileCache::save(const Makefile *makefile, const MacroTable *macroTable,
+                         const QStringList &files, const QStringList &missingFiles)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << cacheFileMagic << cacheFormatVersion << m_key;
+
+    QStringList uniqueFiles = files;
+    uniqueFiles.removeDuplicates();
+    stream << quint32(uniqueFiles.count());
+    foreach (const QString &filePath, uniqueFiles) {
+        const QByteArray hash = fileHash(filePath);
+        if (hash.isEmpty())
+            return false;
+        stream << filePath << hash;
+    }
+    stream << missingFiles;
+
+    // macro table
+    stream << quint32(macroTable->m_macros.count());
+    for (QHash<QString, MacroTable::MacroData>::const_iterator it = macroTable->m_macros.begin();
+         it != macroTable->m_macros.end(); ++it)
+    {
+        stream << it.key() << quint8(it->source) << it->isReadOnly << it->value;
+    }
+    const ProcessEnvironment &environment = macroTable->environment();
+    stream << quint32(environment.count());
+    for (ProcessEnvironment::const_iterator it = environment.begin(); it != environment.end(); ++it)
+        stream << it.key().toQString() << it.value();
+
+    // makefile properties and inference rules
+    stream << makefile->isParallelExecutionDisabled()
+           << makefile->preciousTargets()
+           << makefile->responseFileTools();
+
+    QHash<const InferenceRule *, qint32> ruleIndices;
+    stream << quint32(makefile->inferenceRules().count());
+    foreach (const InferenceRule *rule, makefile->inferenceRules()) {
+        ruleIndices.insert(rule, ruleIndices.count());
+        stream << rule->m_batchMode << rule->m_fromSearchPath << rule->m_fromExtension
+               << rule->m_toSearchPath << rule->m_toExtension << qint32(rule->m_priority);
+        writeCommands(stream, rule->m_commands);
+    }
+
+    // targets
+    const DescriptionBlock *firstTarget = makefile->firstTarget();
+    stream << (firstTarget ? firstTarget->targetName().toLower() : QString())
+           << quint32(makefile->targets().count());
+    foreach (const DescriptionBlock *target, makefile->targets()) {
+        QVector<qint32> targetRuleIndices;
+        foreach (const InferenceRule *rule, target->m_inferenceRules)
+            targetRuleIndices.append(ruleIndices.value(rule, -1));
+        stream << target->targetName() << target->m_dependents;
+        writeCommands(stream, target->m_commands);
+        stream << target->m_bInferenceRulesPreselected << qint8(target->m_canAddCommands)
+               << targetRuleIndices;
+    }
+
+    if (!QDir().mkpath(m_directory))
+        return false;
+
+    // Concurrent jom instances may write the same snapshot.
+    // QSaveFile replaces the cache file atomically.
+    QSaveFile file(fileName());
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(data);
+    return file.commit();
+}
+
+} // namespace NMakeFile
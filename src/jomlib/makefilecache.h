@@ -0,0 +1,78 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef MAKEFILECACHE_H
+#define MAKEFILECACHE_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QStringList>
+
+namespace NMakeFile {
+
+class MacroTable;
+class Makefile;
+class Options;
+
+/**
+ * Binary snapshot cache of parsed makefiles.
+ *
+ * A snapshot contains the parsed targets, inference rules and the macro table.
+ * It is stored in the cache directory under a key that is computed from the
+ * makefile name, the active targets, the options that influence parsing and the
+ * macro table before parsing. The macro table covers the environment, the
+ * command line macros and the predefined macros.
+ *
+ * The snapshot also records the content hashes of all makefiles that were read
+ * and the include file candidates that did not exist. It is only used if all
+ * those files are unchanged.
+ */
+class MakefileCache
+{
+public:
+    explicit MakefileCache(const QString &directory);
+
+    void setKey(const QString &makefileName, const QStringList &activeTargets,
+                const Options *options, const MacroTable *macroTable);
+    QString fileName() const;
+
+    bool load(Makefile *makefile, MacroTable *macroTable);
+    bool save(const Makefile *makefile, const MacroTable *macroTable,
+              const QStringList &files, const QStringList &missingFiles);
+
+    /**
+     * The files that were read for the snapshot, as recorded by the last load().
+     * Available, even if the snapshot was outdated.
+     */
+    const QStringList &recordedFiles() const { return m_recordedFiles; }
+
+private:
+    QString m_directory;
+    QByteArray m_key;
+    QStringList m_recordedFiles;
+};
+
+} // namespace NMakeFile
+
+#endif // MAKEFILECACHE_H
@@ -27,6 +27,7 @@
 #include "makefilefactory.h"
 #include "macrotable.h"
 #include "makefile.h"
+#include "makefilecache.h"
 #include "options.h"
 #include "parser.h"
 #include "preprocessor.h"
@@ -38,7 +39,8 @@ namespace NMakeFile {
 
 MakefileFactory::MakefileFactory()
 :   m_makefile(0),
-    m_errorType(NoError)
+    m_errorType(NoError),
+    m_makefileLoadedFromCache(false)
 {
 }
 
@@ -55,6 +57,7 @@ void MakefileFactory::clear()
 {
     m_makefile = 0;
     m_errorType = NoError;
+    m_makefileLoadedFromCache = false;
     m_errorString.clear();
     m_activeTargets.clear();
 }
@@ -160,11 +163,24 @@ bool MakefileFactory::apply(const QStringList& commandLineArguments, Options **o
         m_makefile = new Makefile(filename);
         m_makefile->setOptions(options);
         m_makefile->setMacroTable(macroTable);
+        MakefileCache cache(options->parseCacheDirectory);
+        if (!options->parseCacheDirectory.isEmpty()) {
+            cache.setKey(filename, m_activeTargets, options, macroTable);
+            if (cache.load(m_makefile, macroTable)) {
+                m_makefileLoadedFromCache = true;
+                return true;
+            }
+        }
         Preprocessor preprocessor;
         preprocessor.setMacroTable(macroTable);
+        preprocessor.prefetchFiles(cache.recordedFiles());
         preprocessor.openFile(filename);
         Parser parser;
         parser.apply(&preprocessor, m_makefile, m_activeTargets);
+        if (!options->parseCacheDirectory.isEmpty() && preprocessor.isCacheable()) {
+            cache.save(m_makefile, macroTable, preprocessor.openedFiles(),
+                       preprocessor.missingIncludeFiles());
+        }
     } catch (Exception &e) {
         m_errorType = ParserError;
         m_errorString = e.toString();
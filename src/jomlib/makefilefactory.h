@@ -39,6 +39,7 @@ class MakefileFactory
 public:
     MakefileFactory();
     void setEnvironment(const QStringList& env);
+    void setEnvironment(const ProcessEnvironment &env) { m_environment = env; }
     bool apply(const QStringList& commandLineArguments, Options **outopt = 0);
 
     enum ErrorType {
@@ -52,6 +53,7 @@ public:
     const QStringList& activeTargets() const { return m_activeTargets; }
     const QString& errorString() const { return m_errorString; }
     ErrorType errorType() const { return m_errorType; }
+    bool makefileLoadedFromCache() const { return m_makefileLoadedFromCache; }
 
 private:
     void clear();
@@ -62,6 +64,7 @@ private:
     QStringList m_activeTargets;
     QString     m_errorString;
     ErrorType   m_errorType;
+    bool        m_makefileLoadedFromCache;
 };
 
 } // namespace NMakeFile
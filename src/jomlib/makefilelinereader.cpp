@@ -28,12 +28,20 @@
 #include <QTextCodec>
 #include <QDebug>
 
+#include <climits>
+#include <cstring>
+
 namespace NMakeFile {
 
 MakefileLineReader::MakefileLineReader(const QString& filename)
 :   m_file(filename),
     m_nLineBufferSize(m_nInitialLineBufferSize),
-    m_nLineNumber(0)
+    m_nLineNumber(0),
+    m_memoryMappingEnabled(true),
+    m_mappedData(0),
+    m_mappedEncoding(MappedLatin1),
+    m_mappedSize(0),
+    m_mappedPos(0)
 {
     m_lineBuffer = reinterpret_cast<char*>( malloc(m_nLineBufferSize) );
 }
@@ -46,6 +54,17 @@ MakefileLineReader::~MakefileLineReader()
 
 bool MakefileLineReader::open()
 {
+    if (!m_decodedContent.isNull()) {
+        // The content was read and decoded in advance, e.g. by the
+        // IncludePrefetcher. Read the lines from the UTF-16 string.
+        m_mappedData = reinterpret_cast<uchar *>(const_cast<ushort *>(m_decodedContent.utf16()));
+        m_mappedEncoding = MappedUtf16;
+        m_mappedSize = qint64(m_decodedContent.size()) * 2;
+        m_mappedPos = 0;
+        m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_mappedUtf16;
+        return true;
+    }
+
     if (!m_file.open(QIODevice::ReadOnly | QIODevice::Text))
         return false;
 
@@ -58,7 +77,32 @@ bool MakefileLineReader::open()
     else if (buf.startsWith("\xEF\xBB\xBF"))
         fileEncoding = FCUTF8;
 
-    if (fileEncoding == FCLatin1) {
+    // Map the whole file into memory if possible.
+    // Mapping fails for empty files. Use buffered reading then.
+    const qint64 fileSize = m_file.size();
+    if (m_memoryMappingEnabled && fileSize > 0 && fileSize < INT_MAX)
+        m_mappedData = m_file.map(0, fileSize);
+
+    if (m_mappedData) {
+        m_mappedSize = fileSize;
+        switch (fileEncoding) {
+        case FCLatin1:
+            m_mappedEncoding = MappedLatin1;
+            m_mappedPos = 0;
+            m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_mapped;
+            break;
+        case FCUTF8:
+            m_mappedEncoding = MappedUtf8;
+            m_mappedPos = 3;
+            m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_mapped;
+            break;
+        case FCUTF16:
+            m_mappedEncoding = MappedUtf16;
+            m_mappedPos = 2;
+            m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_mappedUtf16;
+            break;
+        }
+    } else if (fileEncoding == FCLatin1) {
         m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_local8bit;
     } else {
         m_readLineImpl = &NMakeFile::MakefileLineReader::readLine_impl_unicode;
@@ -72,9 +116,30 @@ bool MakefileLineReader::open()
 
 void MakefileLineReader::close()
 {
+    if (m_mappedData) {
+        if (m_decodedContent.isNull())
+            m_file.unmap(m_mappedData);
+        m_mappedData = 0;
+    }
+    m_decodedContent.clear();
     m_file.close();
 }
 
+/**
+ * Decodes the complete content of a makefile like open() and readLine() do.
+ * The byte order mark selects UTF-8 or UTF-16LE. Other files are Latin-1.
+ */
+QString MakefileLineReader::decodeContent(const QByteArray &data)
+{
+    if (data.startsWith("\xFF\xFE")) {
+        return QString::fromUtf16(reinterpret_cast<const ushort *>(data.constData() + 2),
+                                  (data.size() - 2) / 2);
+    }
+    if (data.startsWith("\xEF\xBB\xBF"))
+        return QString::fromUtf8(data.constData() + 3, data.size() - 3);
+    return QString::fromLatin1(data.constData(), data.size());
+}
+
 void MakefileLineReader::growLineBuffer(size_t nGrow)
 {
     //fprintf(stderr, "realloc %d -> %d\n", m_nLineBufferSize, m_nLineBufferSize + nGrow);
@@ -92,12 +157,170 @@ MakefileLine MakefileLineReader::readLine(bool bInlineFileMode)
 {
     if (bInlineFileMode) {
         m_nLineNumber++;
+        if (m_mappedData) {
+            QString str;
+            int length;
+            bool hasNewline;
+            if (m_mappedEncoding == MappedUtf16) {
+                const ushort *begin;
+                if (!nextMappedUtf16Line(&begin, &length, &hasNewline))
+                    return {};
+                str = QString::fromUtf16(begin, length);
+            } else {
+                const char *begin;
+                if (!nextMappedLine(&begin, &length, &hasNewline))
+                    return {};
+                str = decode8Bit(begin, length);
+            }
+            if (hasNewline)
+                str += QLatin1Char('\n');
+            return MakefileLine{ str };
+        }
         return MakefileLine{ QString::fromLatin1(m_file.readLine()) };
     }
 
     return (this->*m_readLineImpl)();
 }
 
+QString MakefileLineReader::decode8Bit(const char *str, int length) const
+{
+    return m_mappedEncoding == MappedUtf8
+            ? QString::fromUtf8(str, length) : QString::fromLatin1(str, length);
+}
+
+/**
+ * Returns the next line of the mapped file without the line terminator.
+ * Like QIODevice::readLine in text mode, \r\n is treated as \n.
+ *
+ * This is used for Latin-1 and UTF-8 files. In UTF-8 the bytes of
+ * multi-byte sequences never match ASCII characters.
+ */
+bool MakefileLineReader::nextMappedLine(const char **begin, int *length, bool *hasNewline)
+{
+    if (m_mappedPos >= m_mappedSize)
+        return false;
+
+    const char *data = reinterpret_cast<const char *>(m_mappedData);
+    const char *lineBegin = data + m_mappedPos;
+    const size_t remaining = size_t(m_mappedSize - m_mappedPos);
+
+    // memchr is vectorized by the C runtime.
+    const char *lineEnd = static_cast<const char *>(memchr(lineBegin, '\n', remaining));
+    if (lineEnd) {
+        m_mappedPos = lineEnd + 1 - data;
+        *hasNewline = true;
+        if (lineEnd > lineBegin && lineEnd[-1] == '\r')
+            --lineEnd;
+    } else {
+        lineEnd = lineBegin + remaining;
+        m_mappedPos = m_mappedSize;
+        *hasNewline = false;
+    }
+
+    *begin = lineBegin;
+    *length = int(lineEnd - lineBegin);
+    return true;
+}
+
+/**
+ * Returns the next line of the mapped UTF-16LE file without the line terminator.
+ * A trailing odd byte is ignored.
+ */
+bool MakefileLineReader::nextMappedUtf16Line(const ushort **begin, int *length, bool *hasNewline)
+{
+    const qint64 unitCount = (m_mappedSize - m_mappedPos) / 2;
+    if (unitCount <= 0)
+        return false;
+
+    const ushort *lineBegin = reinterpret_cast<const ushort *>(m_mappedData + m_mappedPos);
+    const ushort *end = lineBegin + unitCount;
+    const ushort *lineEnd = lineBegin;
+    while (lineEnd < end && *lineEnd != '\n')
+        ++lineEnd;
+
+    if (lineEnd < end) {
+        m_mappedPos = reinterpret_cast<const uchar *>(lineEnd + 1) - m_mappedData;
+        *hasNewline = true;
+        if (lineEnd > lineBegin && lineEnd[-1] == '\r')
+            --lineEnd;
+    } else {
+        m_mappedPos = m_mappedSize;
+        *hasNewline = false;
+    }
+
+    *begin = lineBegin;
+    *length = int(lineEnd - lineBegin);
+    return true;
+}
+
+/**
+ * Creates a MakefileLine from a line without its line terminator.
+ * Handles the continuation characters at the end of the line.
+ */
+template <typename Char, typename Decoder>
+static MakefileLine makefileLine(const Char *buf, int bufLength, Decoder decode)
+{
+    MakefileLine line;
+    if (bufLength >= 1 && buf[bufLength - 1] == '\\') {
+        if (bufLength >= 2 && buf[bufLength - 2] == '^') {
+            // replace "^\\" -> "\\"
+            line.content = decode(buf, bufLength - 2);
+            line.content += QLatin1Char('\\');
+        } else if (bufLength >= 2 && buf[bufLength - 2] == '\\') {
+            line.content = decode(buf, bufLength);
+        } else {
+            line.content = decode(buf, bufLength - 1);
+            line.continuation = LineContinuationType::Backslash;
+        }
+    } else if (bufLength >= 1 && buf[bufLength - 1] == '^') {
+        line.content = decode(buf, bufLength - 1);
+        line.continuation = LineContinuationType::Caret;
+    } else {
+        line.content = decode(buf, bufLength);
+    }
+    return line;
+}
+
+/**
+ * readLine implementation for memory mapped Latin-1 and UTF-8 files.
+ * Lines are converted directly from the mapped file without copying them
+ * into a line buffer first.
+ */
+MakefileLine MakefileLineReader::readLine_impl_mapped()
+{
+    const char *buf;
+    int bufLength;
+    bool hasNewline;
+    do {
+        m_nLineNumber++;
+        if (!nextMappedLine(&buf, &bufLength, &hasNewline))
+            return {};
+    } while (bufLength > 0 && buf[0] == '#');
+
+    return makefileLine(buf, bufLength, [this](const char *str, int length) {
+        return decode8Bit(str, length);
+    });
+}
+
+/**
+ * readLine implementation for memory mapped UTF-16LE files.
+ */
+MakefileLine MakefileLineReader::readLine_impl_mappedUtf16()
+{
+    const ushort *buf;
+    int bufLength;
+    bool hasNewline;
+    do {
+        m_nLineNumber++;
+        if (!nextMappedUtf16Line(&buf, &bufLength, &hasNewline))
+            return {};
+    } while (bufLength > 0 && buf[0] == '#');
+
+    return makefileLine(buf, bufLength, [](const ushort *str, int length) {
+        return QString::fromUtf16(str, length);
+    });
+}
+
 /**
  * readLine implementation optimized for 8 bit files.
  */
@@ -157,8 +380,8 @@ MakefileLine MakefileLineReader::readLine_impl_local8bit()
 }
 
 /**
- * readLine implementation for unicode files.
- * Much slower than the 8 bit version.
+ * readLine implementation for unicode files that cannot be memory mapped.
+ * Much slower than the mapped version.
  */
 MakefileLine MakefileLineReader::readLine_impl_unicode()
 {
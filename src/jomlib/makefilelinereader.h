@@ -54,6 +54,10 @@ public:
     MakefileLineReader(const QString& filename);
     ~MakefileLineReader();
 
+    void setMemoryMappingEnabled(bool enabled) { m_memoryMappingEnabled = enabled; }
+    bool isMemoryMappingEnabled() const { return m_memoryMappingEnabled; }
+    void setDecodedContent(const QString &content) { m_decodedContent = content; }
+    static QString decodeContent(const QByteArray &data);
     bool open();
     void close();
     MakefileLine readLine(bool bInlineFileMode);
@@ -62,9 +66,14 @@ public:
 
 private:
     void growLineBuffer(size_t nGrow);
+    bool nextMappedLine(const char **begin, int *length, bool *hasNewline);
+    bool nextMappedUtf16Line(const ushort **begin, int *length, bool *hasNewline);
+    QString decode8Bit(const char *str, int length) const;
 
     typedef MakefileLine (MakefileLineReader::*ReadLineImpl)();
     ReadLineImpl m_readLineImpl;
+    MakefileLine readLine_impl_mapped();
+    MakefileLine readLine_impl_mappedUtf16();
     MakefileLine readLine_impl_local8bit();
     MakefileLine readLine_impl_unicode();
 
@@ -76,6 +85,12 @@ private:
     size_t m_nLineBufferSize;
     char *m_lineBuffer;
     uint m_nLineNumber;
+    bool m_memoryMappingEnabled;
+    uchar *m_mappedData;
+    enum MappedEncoding { MappedLatin1, MappedUtf8, MappedUtf16 } m_mappedEncoding;
+    qint64 m_mappedSize;
+    qint64 m_mappedPos;
+    QString m_decodedContent;
 };
 
 } // namespace NMakeFile
@@ -0,0 +1,262 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "nestedbuild.h"
+#include "exception.h"
+#include "helperfunctions.h"
+#include "macrotable.h"
+#include "makefile.h"
+#include "makefilefactory.h"
+#include "options.h"
+#include "targetexecutor.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QEventLoop>
+
+namespace NMakeFile {
+
+NestedBuild::NestedBuild(QObject *parent)
+    : QObject(parent)
+    , m_executor(0)
+    , m_running(false)
+{
+}
+
+NestedBuild::~NestedBuild()
+{
+    // The executor refers to the makefile.
+    delete m_executor;
+}
+
+/**
+ * Checks one option argument (without the leading slash or dash) of a nested
+ * jom call. Options that change process-wide state (e.g. /J or /X), that
+ * print something instead of building or that change how the output is
+ * written are not supported in-process.
+ *
+ * Long options are recognized at every position of the argument, just like
+ * Options::handleCommandLineOption does it. Every long option that is not
+ * supported contains a letter that is not supported as a short option.
+ */
+static bool isSupportedOption(QString arg, QStringList &arguments, bool *parseCacheSet)
+{
+    while (!arg.isEmpty()) {
+        const QString upperArg = arg.toUpper();
+        if (upperArg.startsWith(QLatin1String("NOLOGO"))) {
+            arg.remove(0, 6);
+            continue;
+        } else if (upperArg.startsWith(QLatin1String("INPROCESSMAKE"))) {
+            arg.remove(0, 13);
+            continue;
+        } else if (upperArg.startsWith(QLatin1String("PARSECACHE"))) {
+            arg.remove(0, 10);
+            if (arg.startsWith(QLatin1Char(':')))
+                arg.remove(0, 1);
+            if (arg.isEmpty()) {
+                if (arguments.isEmpty())
+                    return false;
+                arguments.removeFirst();
+            }
+            *parseCacheSet = true;
+            return true;
+        }
+
+        const QChar ch = arg.at(0).toUpper();
+        arg.remove(0, 1);
+        if (ch == QLatin1Char('F')) {
+            if (arg.isEmpty()) {
+                if (arguments.isEmpty())
+                    return false;
+                arguments.removeFirst();
+            }
+            return true;
+        }
+        if (!QString(QLatin1String("ABCEIKLNRSY")).contains(ch))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Returns true, if the command line calls this jom executable with arguments
+ * that can be handled in-process. The arguments for start() are returned in
+ * arguments.
+ *
+ * Like a jom process, the nested build reads additional options from the
+ * JOMFLAGS or MAKEFLAGS environment variable. The parse cache directory and
+ * /INPROCESSMAKE are passed on to the nested build.
+ *
+ * The target names are moved to the end of the arguments. Their number is
+ * returned in targetCount.
+ */
+bool NestedBuild::parseCommandLine(const QString &commandLine, const Options *options,
+                                   const ProcessEnvironment &environment,
+                                   QStringList *arguments, int *targetCount)
+{
+    // Split off the program, which may be enclosed in double quotes.
+    int idx;
+    QString program;
+    if (commandLine.startsWith(QLatin1Char('"'))) {
+        idx = commandLine.indexOf(QLatin1Char('"'), 1);
+        if (idx < 0)
+            return false;
+        program = commandLine.mid(1, idx - 1);
+        ++idx;
+    } else {
+        for (idx = 0; idx < commandLine.length() && !commandLine.at(idx).isSpace(); ++idx) {}
+        program = commandLine.left(idx);
+    }
+
+    if (QDir::toNativeSeparators(program).compare(options->fullAppPath, Qt::CaseInsensitive) != 0)
+        return false;
+
+    // splitCommandLine doesn't know the escaping rules of the C runtime.
+    const QString argumentString = commandLine.mid(idx);
+    if (argumentString.contains(QLatin1String("\\\""))
+            || argumentString.contains(QLatin1String("\"\""))) {
+        return false;
+    }
+
+    QStringList args = splitCommandLine(argumentString);
+    QString makeFlags = environment.value(QLatin1String("JOMFLAGS"));
+    if (makeFlags.isEmpty())
+        makeFlags = environment.value(QLatin1String("MAKEFLAGS"));
+    if (makeFlags.startsWith(QLatin1Char('-')))
+        makeFlags.remove(0, 1);
+    if (!makeFlags.isEmpty())
+        args.prepend(QLatin1Char('/') + makeFlags);
+
+    bool parseCacheSet = false;
+    QStringList remaining = args;
+    QStringList settings;
+    QStringList targets;
+    while (!remaining.isEmpty()) {
+        const QString arg = remaining.takeFirst();
+        if (arg.startsWith(QLatin1Char('@'))) {
+            return false;
+        } else if (arg.startsWith(QLatin1Char('/')) || arg.startsWith(QLatin1Char('-'))) {
+            const int remainingCount = remaining.count();
+            const QString value = remaining.value(0);
+            if (!isSupportedOption(arg.mid(1).trimmed(), remaining, &parseCacheSet))
+                return false;
+            settings.append(arg);
+            if (remaining.count() < remainingCount)
+                settings.append(value);
+        } else if (arg.contains(QLatin1Char('='))) {
+            // Options::readCommandLineArguments exits on invalid macro names.
+            const QString name = arg.left(arg.indexOf(QLatin1Char('='))).trimmed();
+            if (!MacroTable::isMacroNameValid(name))
+                return false;
+            settings.append(arg);
+        } else {
+            targets.append(arg);
+        }
+    }
+
+    if (!parseCacheSet && !options->parseCacheDirectory.isEmpty())
+        settings << QLatin1String("/PARSECACHE") << options->parseCacheDirectory;
+    settings.append(QLatin1String("/INPROCESSMAKE"));
+    *arguments = settings + targets;
+    if (targetCount)
+        *targetCount = targets.count();
+    return true;
+}
+
+/**
+ * Parses the makefile and starts building the targets, like a jom process
+ * with the given arguments and environment would do. Errors are reported
+ * with the same messages and exit codes.
+ * The finished signal is emitted when the build is done, which might
+ * happen before this function returns.
+ */
+void NestedBuild::start(const QStringList &arguments, const ProcessEnvironment &environment)
+{
+    m_running = true;
+
+    MakefileFactory factory;
+    Options *options = 0;
+    factory.setEnvironment(environment);
+    if (!factory.apply(arguments, &options)) {
+        if (factory.makefile())
+            delete factory.makefile();
+        else
+            delete options;
+        if (factory.errorType() == MakefileFactory::CommandLineError) {
+            finish(128);
+        } else {
+            emit standardError("Error: " + factory.errorString().toLocal8Bit() + '\n');
+            finish(2);
+        }
+        return;
+    }
+
+    m_makefile.reset(factory.makefile());
+    if (m_makefile->isParallelExecutionDisabled()) {
+        emit standardOutput("jom: parallel job execution disabled for "
+                            + m_makefile->fileName().toLocal8Bit() + '\n');
+    }
+
+    m_executor = new TargetExecutor(m_makefile->macroTable()->environment());
+    m_executor->setOutputForwardingEnabled(true);
+    connect(m_executor, &TargetExecutor::standardOutput, this, &NestedBuild::standardOutput);
+    connect(m_executor, &TargetExecutor::standardError, this, &NestedBuild::standardError);
+    connect(m_executor, &TargetExecutor::finished, this, &NestedBuild::finish);
+    try {
+        m_executor->apply(m_makefile.data(), factory.activeTargets());
+    } catch (const Exception &e) {
+        emit standardError("jom: " + e.message().toLocal8Bit() + '\n');
+        finish(2);
+    }
+}
+
+/**
+ * Runs an event loop until the nested build has finished.
+ */
+void NestedBuild::waitForFinished()
+{
+    if (!m_running)
+        return;
+    QEventLoop loop;
+    connect(this, &NestedBuild::finished, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+void NestedBuild::removeTempFiles()
+{
+    if (m_executor)
+        m_executor->removeTempFiles();
+}
+
+void NestedBuild::finish(int exitCode)
+{
+    if (!m_running)
+        return;
+    m_running = false;
+    if (m_executor)
+        m_executor->disconnect(this);
+    emit finished(exitCode);
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,86 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef NESTEDBUILD_H
+#define NESTEDBUILD_H
+
+#include "processenvironment.h"
+#include <QtCore/QObject>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QStringList>
+
+namespace NMakeFile {
+
+class Makefile;
+class Options;
+class TargetExecutor;
+
+/**
+ * Runs a recursive jom invocation inside the jom process that executes the
+ * command, instead of starting a new jom process.
+ *
+ * The nested build parses its makefile with a MakefileFactory and builds it
+ * with its own TargetExecutor. It uses the job server of the parent build
+ * and shares the file time cache with it. The output of the nested build's
+ * commands is forwarded through the standardOutput and standardError
+ * signals.
+ *
+ * Only command lines that would run this jom executable in jom's working
+ * directory with options that are known to be safe are run in-process.
+ * See parseCommandLine().
+ */
+class NestedBuild : public QObject
+{
+    Q_OBJECT
+public:
+    explicit NestedBuild(QObject *parent = 0);
+    ~NestedBuild();
+
+    static bool parseCommandLine(const QString &commandLine, const Options *options,
+                                 const ProcessEnvironment &environment,
+                                 QStringList *arguments, int *targetCount = 0);
+
+    void start(const QStringList &arguments, const ProcessEnvironment &environment);
+    bool isRunning() const { return m_running; }
+    void waitForFinished();
+    void removeTempFiles();
+
+signals:
+    void standardOutput(const QByteArray &data);
+    void standardError(const QByteArray &data);
+    void finished(int exitCode);
+
+private slots:
+    void finish(int exitCode);
+
+private:
+    QScopedPointer<Makefile> m_makefile;
+    TargetExecutor *m_executor;
+    bool m_running;
+};
+
+} // namespace NMakeFile
+
+#endif // NESTEDBUILD_H
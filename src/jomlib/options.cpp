@@ -67,7 +67,14 @@ Options::Options()
     showUsageAndExit(false),
     displayBuildInfo(false),
     debugMode(false),
-    showVersionAndExit(false)
+    showVersionAndExit(false),
+    lineOutput(false),
+    orderedOutput(false),
+    inProcessMake(false),
+    globalGraph(false),
+    outputBufferLimit(64),
+    maxCommandLineLength(0),
+    batchWindow(0)
 {
 }
 
@@ -186,6 +193,24 @@ bool Options::expandCommandFiles(QStringList& arguments)
     return true;
 }
 
+static bool takeLongOptionValue(const char *optionName, QString &arg, QStringList &arguments,
+                                QString &value)
+{
+    if (arg.startsWith(QLatin1Char(':')))
+        arg.remove(0, 1);
+    if (arg.isEmpty()) {
+        if (arguments.isEmpty()) {
+            fprintf(stderr, "Error: no value specified for option /%s\n", optionName);
+            return false;
+        }
+        value = arguments.takeFirst();
+    } else {
+        value = arg;
+        arg = QString();
+    }
+    return true;
+}
+
 bool Options::handleCommandLineOption(const QStringList &originalArguments, QString arg, QStringList& arguments, QString& makefile, QString& makeflags)
 {
     while (!arg.isEmpty()) {
@@ -195,6 +220,18 @@ bool Options::handleCommandLineOption(const QStringList &originalArguments, QStr
                 makeflags.append(QLatin1Char('L'));
                 arg.remove(0, 6);
                 showLogo = false;
+            } else if (upperArg.startsWith(QLatin1String("BATCHWINDOW"))) {
+                arg.remove(0, 11);
+                QString windowStr;
+                if (!takeLongOptionValue("BATCHWINDOW", arg, arguments, windowStr))
+                    return false;
+                bool ok;
+                batchWindow = windowStr.toInt(&ok);
+                if (!ok || batchWindow < 0) {
+                    fputs("Error: option /BATCHWINDOW expects a non-negative number of milliseconds.\n",
+                          stderr);
+                    return false;
+                }
             } else if (upperArg.startsWith(QLatin1String("DUMPGRAPHDOT"))) {
                 arg.remove(0, 12);
                 dumpDependencyGraph = true;
@@ -210,6 +247,54 @@ bool Options::handleCommandLineOption(const QStringList &originalArguments, QStr
             } else if (upperArg.startsWith(QLatin1String("ERRORREPORT"))) {
                 arg.remove(0, 11);
                 // ignore - we don't send stuff to Microsoft :)
+            } else if (upperArg.startsWith(QLatin1String("GLOBALGRAPH"))) {
+                arg.remove(0, 11);
+                globalGraph = true;
+            } else if (upperArg.startsWith(QLatin1String("INPROCESSMAKE"))) {
+                arg.remove(0, 13);
+                inProcessMake = true;
+            } else if (upperArg.startsWith(QLatin1String("LINEOUTPUT"))) {
+                arg.remove(0, 10);
+                lineOutput = true;
+            } else if (upperArg.startsWith(QLatin1String("LOGDIR"))) {
+                arg.remove(0, 6);
+                if (!takeLongOptionValue("LOGDIR", arg, arguments, logDirectory))
+                    return false;
+            } else if (upperArg.startsWith(QLatin1String("MAXCMDLINE"))) {
+                arg.remove(0, 10);
+                QString lengthStr;
+                if (!takeLongOptionValue("MAXCMDLINE", arg, arguments, lengthStr))
+                    return false;
+                bool ok;
+                maxCommandLineLength = lengthStr.toInt(&ok);
+                if (!ok || maxCommandLineLength < 0) {
+                    fputs("Error: option /MAXCMDLINE expects a non-negative number of characters.\n",
+                          stderr);
+                    return false;
+                }
+            } else if (upperArg.startsWith(QLatin1String("ORDEREDOUTPUT"))) {
+                arg.remove(0, 13);
+                orderedOutput = true;
+            } else if (upperArg.startsWith(QLatin1String("OUTPUTBUFFERLIMIT"))) {
+                arg.remove(0, 17);
+                QString limitStr;
+                if (!takeLongOptionValue("OUTPUTBUFFERLIMIT", arg, arguments, limitStr))
+                    return false;
+                bool ok;
+                outputBufferLimit = limitStr.toUInt(&ok);
+                if (!ok || outputBufferLimit < 1) {
+                    fputs("Error: option /OUTPUTBUFFERLIMIT expects a positive number of megabytes.\n",
+                          stderr);
+                    return false;
+                }
+            } else if (upperArg.startsWith(QLatin1String("PARSECACHE"))) {
+                arg.remove(0, 10);
+                if (!takeLongOptionValue("PARSECACHE", arg, arguments, parseCacheDirectory))
+                    return false;
+            } else if (upperArg.startsWith(QLatin1String("RESOURCEREPORT"))) {
+                arg.remove(0, 14);
+                if (!takeLongOptionValue("RESOURCEREPORT", arg, arguments, resourceReportFile))
+                    return false;
             } else if (upperArg.startsWith(QLatin1String("VERSION"))) {
                 arg.remove(0, 7);
                 showVersionAndExit = true;
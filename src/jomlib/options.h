@@ -64,8 +64,18 @@ public:
     bool displayBuildInfo;
     bool debugMode;
     bool showVersionAndExit;
+    bool lineOutput;
+    bool orderedOutput;
+    bool inProcessMake;
+    bool globalGraph;
+    int outputBufferLimit;  // in megabytes
+    int maxCommandLineLength;
+    int batchWindow;        // in milliseconds
     QString fullAppPath;
     QString stderrFile;
+    QString resourceReportFile;
+    QString logDirectory;
+    QString parseCacheDirectory;
 
 private:
     bool expandCommandFiles(QStringList& arguments);
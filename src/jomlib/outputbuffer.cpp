@@ -0,0 +1,262 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#include "outputbuffer.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QMutex>
+#include <QtCore/QTemporaryFile>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace NMakeFile {
+
+struct BlockFreeList
+{
+    enum { MaxSize = 64 };
+
+    ~BlockFreeList()
+    {
+        foreach (void *block, blocks)
+            free(block);
+    }
+
+    QMutex mutex;
+    QVector<void *> blocks;
+};
+
+Q_GLOBAL_STATIC(BlockFreeList, blockFreeList)
+
+OutputBuffer::OutputBuffer()
+    : m_lastRecord(0)
+    , m_size(0)
+    , m_memorySize(0)
+    , m_memoryLimit(0)
+    , m_spillFile(0)
+    , m_spillFailed(false)
+{
+}
+
+OutputBuffer::~OutputBuffer()
+{
+    clear();
+}
+
+OutputBuffer::Block *OutputBuffer::allocateBlock()
+{
+    Block *block = 0;
+    BlockFreeList *freeList = blockFreeList();
+    freeList->mutex.lock();
+    if (!freeList->blocks.isEmpty()) {
+        block = static_cast<Block *>(freeList->blocks.last());
+        freeList->blocks.removeLast();
+    }
+    freeList->mutex.unlock();
+    if (!block)
+        block = static_cast<Block *>(malloc(sizeof(Block)));
+    block->used = 0;
+    return block;
+}
+
+void OutputBuffer::releaseBlock(Block *block)
+{
+    BlockFreeList *freeList = blockFreeList();
+    freeList->mutex.lock();
+    if (freeList->blocks.count() < BlockFreeList::MaxSize) {
+        freeList->blocks.append(block);
+        block = 0;
+    }
+    freeList->mutex.unlock();
+    free(block);
+}
+
+/**
+ * Appends data to the buffer.
+ * If the last record belongs to the same channel, the data is added to that record.
+ */
+void OutputBuffer::append(Channel channel, const char *data, int length)
+{
+    m_size += length;
+    if (!m_spillFailed
+            && (m_spillFile || (m_memoryLimit > 0 && m_memorySize + length > m_memoryLimit))) {
+        if (spill(channel, data, length))
+            return;
+
+        // Writing to the disk failed. Keep all output in memory from now on.
+        // The spilled records are moved behind the blocks to keep one order.
+        m_spillFailed = true;
+        unspill();
+    }
+
+    appendToMemory(channel, data, length);
+}
+
+void OutputBuffer::appendToMemory(Channel channel, const char *data, int length)
+{
+    m_memorySize += length;
+    while (length > 0) {
+        Block *block = m_blocks.isEmpty() ? 0 : m_blocks.last();
+        if (block && m_lastRecord && m_lastRecord->channel == quint32(channel)
+                && block->used < BlockSize) {
+            const int n = qMin(length, BlockSize - block->used);
+            memcpy(block->data + block->used, data, n);
+            block->used += n;
+            m_lastRecord->length += n;
+            data += n;
+            length -= n;
+            continue;
+        }
+
+        // Start a new record.
+        const int pos = block ? alignedRecordPosition(block->used) : BlockSize;
+        if (pos + int(sizeof(RecordHeader)) >= BlockSize) {
+            block = allocateBlock();
+            m_blocks.append(block);
+            block->used = 0;
+        } else {
+            block->used = pos;
+        }
+        m_lastRecord = reinterpret_cast<RecordHeader *>(block->data + block->used);
+        m_lastRecord->channel = channel;
+        m_lastRecord->length = 0;
+        block->used += sizeof(RecordHeader);
+    }
+}
+
+/**
+ * Appends a record to the spill file. The file is created on first use.
+ * Once data has been spilled, all following data goes to the file as well
+ * to preserve the order of the output.
+ */
+bool OutputBuffer::spill(Channel channel, const char *data, int length)
+{
+    if (!m_spillFile) {
+        m_spillFile = new QTemporaryFile(QDir::tempPath() + QLatin1String("/jom_output_XXXXXX"));
+        if (!m_spillFile->open()) {
+            delete m_spillFile;
+            m_spillFile = 0;
+            return false;
+        }
+    }
+
+    RecordHeader header;
+    header.channel = channel;
+    header.length = length;
+    const qint64 oldSize = m_spillFile->size();
+    m_spillFile->seek(oldSize);
+    if (m_spillFile->write(reinterpret_cast<const char *>(&header), sizeof(header))
+                == sizeof(header)
+            && m_spillFile->write(data, length) == length) {
+        return true;
+    }
+
+    // Do not leave a truncated record behind.
+    m_spillFile->resize(oldSize);
+    return false;
+}
+
+/**
+ * Moves the records of the spill file behind the records in memory and removes the file.
+ */
+void OutputBuffer::unspill()
+{
+    if (!m_spillFile)
+        return;
+
+    Channel channel;
+    QByteArray data;
+    qint64 pos = 0;
+    while (readSpilledRecord(&pos, &channel, &data))
+        appendToMemory(channel, data.constData(), data.size());
+    delete m_spillFile;
+    m_spillFile = 0;
+}
+
+bool OutputBuffer::readSpilledRecord(qint64 *pos, Channel *channel, QByteArray *data) const
+{
+    RecordHeader header;
+    if (!m_spillFile->seek(*pos)
+            || m_spillFile->read(reinterpret_cast<char *>(&header), sizeof(header))
+                != sizeof(header)) {
+        return false;
+    }
+    data->resize(header.length);
+    if (m_spillFile->read(data->data(), header.length) != qint64(header.length))
+        return false;
+    *pos += sizeof(header) + header.length;
+    *channel = static_cast<Channel>(header.channel);
+    return true;
+}
+
+void OutputBuffer::clear()
+{
+    foreach (Block *block, m_blocks)
+        releaseBlock(block);
+    m_blocks.clear();
+    m_lastRecord = 0;
+    m_size = 0;
+    m_memorySize = 0;
+    delete m_spillFile;
+    m_spillFile = 0;
+    m_spillFailed = false;
+}
+
+/**
+ * Moves the records that are held in memory to the spill file.
+ * Returns false, if the data could not be written. The buffer is unchanged then.
+ */
+bool OutputBuffer::spillToDisk()
+{
+    if (m_blocks.isEmpty())
+        return true;
+    if (m_spillFailed)
+        return false;
+
+    OutputBuffer spilled;
+    bool ok = true;
+    forEachChunk([&spilled, &ok](Channel channel, const char *data, int length) {
+        ok = ok && spilled.spill(channel, data, length);
+    });
+    if (!ok)
+        return false;
+
+    spilled.m_size = m_size;
+    swap(spilled);
+    return true;
+}
+
+void OutputBuffer::swap(OutputBuffer &other)
+{
+    m_blocks.swap(other.m_blocks);
+    qSwap(m_lastRecord, other.m_lastRecord);
+    qSwap(m_size, other.m_size);
+    qSwap(m_memorySize, other.m_memorySize);
+    qSwap(m_spillFile, other.m_spillFile);
+    qSwap(m_spillFailed, other.m_spillFailed);
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,143 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+
+#ifndef OUTPUTBUFFER_H
+#define OUTPUTBUFFER_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QVector>
+
+QT_BEGIN_NAMESPACE
+class QTemporaryFile;
+QT_END_NAMESPACE
+
+namespace NMakeFile {
+
+/**
+ * Buffers the interleaved output of a process' stdout and stderr channels.
+ *
+ * The data is stored in fixed-size blocks as a sequence of records. Each record
+ * consists of a small header (channel and length) and the data itself.
+ * Consecutive writes to the same channel are merged into one record.
+ * Blocks are recycled through a process-wide free list.
+ *
+ * If a memory limit is set, data that exceeds the limit is appended to a
+ * temporary file. The content of that file is replayed after the blocks.
+ * If writing to that file fails, its content is moved back into memory and
+ * the buffer does not use the disk anymore.
+ *
+ * OutputBuffer is not thread-safe. Users must lock it themselves.
+ */
+class OutputBuffer
+{
+public:
+    enum Channel
+    {
+        StdOut,
+        StdErr
+    };
+
+    OutputBuffer();
+    ~OutputBuffer();
+
+    void append(Channel channel, const char *data, int length);
+    void clear();
+    void swap(OutputBuffer &other);
+    bool isEmpty() const { return m_size == 0; }
+    qint64 size() const { return m_size; }
+    qint64 memorySize() const { return m_memorySize; }
+    void setMemoryLimit(qint64 limit) { m_memoryLimit = limit; }
+    qint64 memoryLimit() const { return m_memoryLimit; }
+    bool hasSpilledToDisk() const { return m_spillFile != 0; }
+    bool spillToDisk();
+
+    /**
+     * Calls f(channel, data, length) for every record in the order of arrival.
+     */
+    template <typename F>
+    void forEachChunk(F f) const
+    {
+        foreach (const Block *block, m_blocks) {
+            int pos = 0;
+            while (pos < block->used) {
+                const RecordHeader *header
+                        = reinterpret_cast<const RecordHeader *>(block->data + pos);
+                pos += sizeof(RecordHeader);
+                f(static_cast<Channel>(header->channel), block->data + pos, int(header->length));
+                pos = alignedRecordPosition(pos + header->length);
+            }
+        }
+
+        if (m_spillFile) {
+            Channel channel;
+            QByteArray data;
+            qint64 pos = 0;
+            while (readSpilledRecord(&pos, &channel, &data))
+                f(channel, data.constData(), data.size());
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(OutputBuffer)
+
+    enum { BlockSize = 64 * 1024 };
+
+    struct RecordHeader
+    {
+        quint32 channel;
+        quint32 length;
+    };
+
+    struct Block
+    {
+        int used;
+        char data[BlockSize];
+    };
+
+    static int alignedRecordPosition(int pos)
+    {
+        return (pos + sizeof(RecordHeader) - 1) & ~int(sizeof(RecordHeader) - 1);
+    }
+
+    static Block *allocateBlock();
+    static void releaseBlock(Block *block);
+    void appendToMemory(Channel channel, const char *data, int length);
+    bool spill(Channel channel, const char *data, int length);
+    void unspill();
+    bool readSpilledRecord(qint64 *pos, Channel *channel, QByteArray *data) const;
+
+    QVector<Block *> m_blocks;
+    RecordHeader *m_lastRecord;
+    qint64 m_size;
+    qint64 m_memorySize;
+    qint64 m_memoryLimit;
+    QTemporaryFile *m_spillFile;
+    bool m_spillFailed;
+};
+
+} // namespace NMakeFile
+
+#endif // OUTPUTBUFFER_H
@@ -40,15 +40,28 @@ namespace NMakeFile {
 Parser::Parser()
 :   m_preprocessor(0)
 {
-    m_rexDotDirective.setPattern(QLatin1String("^\\.(IGNORE|PRECIOUS|SILENT|SUFFIXES)\\s*:(.*)"));
-    m_rexInferenceRule.setPattern(QLatin1String("^(\\{.*\\})?(\\.\\w+)(\\{.*\\})?(\\.\\w+)(:{1,2})"));
-    m_rexSingleWhiteSpace.setPattern(QLatin1String("\\s"));
 }
 
 Parser::~Parser()
 {
 }
 
+/**
+ * Returns true if macro expansion can change the line type of line.
+ *
+ * Macro expansion keeps the characters in front of the first macro invocation.
+ * Dot directives and inference rules start with '.' or '{'. All other lines
+ * are description blocks, which expand their parts in parseDescriptionBlock.
+ */
+static bool lineTypeMayDependOnMacros(const QString& line)
+{
+    if (!line.contains(QLatin1Char('$')))
+        return false;
+    const QChar firstChar = line.at(0);
+    return firstChar == QLatin1Char('$') || firstChar == QLatin1Char('.')
+            || firstChar == QLatin1Char('{') || firstChar.isSpace();
+}
+
 /**
  * Parses the content, provided by the Preprocessor object and
  * creates a new Makefile object.
@@ -83,14 +96,17 @@ void Parser::apply(Preprocessor* pp,
     try {
         readLine();
         while (!m_line.isNull()) {
-            QString expandedLine = m_preprocessor->macroTable()->expandMacros(m_line);
-            if (isEmptyLine(expandedLine)) {
+            QString expandedLine = m_line;
+            if (lineTypeMayDependOnMacros(m_line))
+                expandedLine = m_preprocessor->macroTable()->expandMacros(m_line);
+            const LineTokenizer::LineType lineType = LineTokenizer::classify(expandedLine, &m_tokens);
+            if (lineType == LineTokenizer::EmptyLine) {
                 readLine();
-            } else if (isDotDirective(expandedLine)) {
+            } else if (lineType == LineTokenizer::DotDirectiveLine) {
                 m_line = expandedLine;
                 Preprocessor::removeInlineComments(m_line);
                 parseDotDirective();
-            } else if (isInferenceRule(expandedLine)) {
+            } else if (lineType == LineTokenizer::InferenceRuleLine) {
                 m_line = expandedLine;
                 Preprocessor::removeInlineComments(m_line);
                 parseInferenceRule();
@@ -112,12 +128,7 @@ void Parser::apply(Preprocessor* pp,
         return;
 
     // make sure that all active targets exist
-    foreach (const QString& targetName, m_activeTargets) {
-        if (!m_makefile->target(targetName)) {
-            QString msg = QLatin1String("Target %1 doesn't exist.");
-            throw Exception(msg.arg(targetName));
-        }
-    }
+    checkTargetsExist(m_activeTargets);
 
     // if no active target is defined, use the first one
     if (m_activeTargets.isEmpty()) {
@@ -135,22 +146,52 @@ void Parser::apply(Preprocessor* pp,
             break;
         target->m_dependents += it.value();
         target->m_dependents.removeDuplicates();
+        target->invalidateDependentTargets();
     }
 
+    prepareTargets(m_activeTargets);
+}
+
+/**
+ * Prepares additional targets of an already parsed makefile for execution,
+ * like apply does it for the active targets.
+ * Several sub-make calls of the same makefile share one Makefile object.
+ */
+void Parser::activateTargets(Makefile *mkfile, const QStringList &targetNames)
+{
+    m_makefile = mkfile;
+    checkTargetsExist(targetNames);
+    prepareTargets(targetNames);
+}
+
+void Parser::checkTargetsExist(const QStringList &targetNames)
+{
+    foreach (const QString& targetName, targetNames) {
+        if (!m_makefile->target(targetName)) {
+            QString msg = QLatin1String("Target %1 doesn't exist.");
+            throw Exception(msg.arg(targetName));
+        }
+    }
+}
+
+void Parser::prepareTargets(const QStringList &targetNames)
+{
     // build rule suffix cache
-    for (int i = m_makefile->inferenceRules().count(); --i >= 0;) {
-        InferenceRule *ir = m_makefile->inferenceRules().at(i);
-        m_ruleIdxByToExtension[ir->m_toExtension].prepend(ir);
+    m_ruleIdxByToExtension.clear();
+    foreach (InferenceRule *ir, m_makefile->inferenceRules()) {
+        if (ir->m_priority < 0)
+            continue;
+        m_ruleIdxByToExtension[ir->m_toExtension.toLower()][ir->m_toSearchPath].append(ir);
     }
 
     // check for cycles in active targets
-    foreach (const QString& targetName, m_activeTargets) {
+    foreach (const QString& targetName, targetNames) {
         DescriptionBlock *target = m_makefile->target(targetName);
         checkForCycles(target);
         preselectInferenceRules(target);
     }
     // reset the droppings left by the cycle checker
-    foreach (const QString& targetName, m_activeTargets) {
+    foreach (const QString& targetName, targetNames) {
         DescriptionBlock *target = m_makefile->target(targetName);
         resetCycleChecker(target);
     }
@@ -166,58 +207,37 @@ void Parser::readLine()
     m_line = m_preprocessor->readLine();
 }
 
-bool Parser::isEmptyLine(const QString& line)
-{
-    return line.trimmed().isEmpty();
-}
-
 /**
  * Returns the index of the command separator or -1 if its non-existent.
+ *
+ * A # outside of double quotes starts a comment, unless it's escaped with ^.
+ * A ; outside of double quotes is the command separator. If the comment starts
+ * before the command separator, the comment is removed and the escape
+ * characters of escaped # characters are removed.
  */
 static int removeCommentsAndFindCommandSeparator(QString& line)
 {
-    if (line.isEmpty())
-        return -1;
-
-    QVector<bool> quotedVector(line.length());
-    quotedVector[0] = (line.at(0) == QLatin1Char('"'));
-    for (int i=1; i < line.length(); ++i) {
-        bool isInDoubleQuote = quotedVector[i-1];
-        if (line.at(i) == QLatin1Char('"'))
+    bool isInDoubleQuote = false;
+    bool escapedCommentCharFound = false;
+    for (int i = 0; i < line.length(); ++i) {
+        const ushort ch = line.at(i).unicode();
+        if (ch == '"') {
             isInDoubleQuote = !isInDoubleQuote;
-        quotedVector[i] = isInDoubleQuote;
-    }
-
-    int commentIdx = -1;
-    QList<int> toRemove;
-    while (true) {
-        commentIdx = line.indexOf(QLatin1Char('#'), commentIdx + 1);
-        if (commentIdx > 0 && (line.at(commentIdx - 1) == QLatin1Char('^'))) {
-            toRemove.append(commentIdx - 1);  // remove the ^ characters later
-            continue;
+        } else if (ch == ';') {
+            if (!isInDoubleQuote)
+                return i;
+        } else if (ch == '#') {
+            if (i > 0 && line.at(i - 1) == QLatin1Char('^')) {
+                escapedCommentCharFound = true;
+            } else if (!isInDoubleQuote) {
+                line.truncate(i);
+                if (escapedCommentCharFound)
+                    line.replace(QLatin1String("^#"), QLatin1String("#"));
+                return -1;
+            }
         }
-        if (commentIdx < 0 || !quotedVector[commentIdx])
-            break;
-    }
-
-    int cmdSepIdx = -1;
-    do {
-        cmdSepIdx = line.indexOf(QLatin1Char(';'), cmdSepIdx + 1);
-    } while (cmdSepIdx >= 0 && quotedVector[cmdSepIdx]);
-
-    if (commentIdx == cmdSepIdx)  // equality means, they are both -1
-        return -1;
-
-    if ((0 <= commentIdx && commentIdx < cmdSepIdx) || cmdSepIdx == -1) {
-        // The # indicates a comment.
-        line.truncate(commentIdx);
-        for (int i=toRemove.count() - 1; i >= 0; i--)
-            line.remove(toRemove.at(i), 1);
-        cmdSepIdx = -1;
-    } else {
-        // The # is inside the command and not a comment.
     }
-    return cmdSepIdx;
+    return -1;
 }
 
 /**
@@ -276,16 +296,6 @@ bool Parser::isDescriptionBlock(int& separatorPos, int& separatorLength, int& co
     return true;
 }
 
-bool Parser::isInferenceRule(const QString& line)
-{
-    return m_rexInferenceRule.exactMatch(line);
-}
-
-bool Parser::isDotDirective(const QString& line)
-{
-    return m_rexDotDirective.exactMatch(line);
-}
-
 DescriptionBlock* Parser::createTarget(const QString& targetName)
 {
     DescriptionBlock* target = new DescriptionBlock(m_makefile);
@@ -356,11 +366,13 @@ static bool containsWildcard(const QString &str)
     return false;
 }
 
-static QStringList expandWildcards(const QString &dirPath, const QStringList &lst)
+static QStringList expandWildcards(const QString &dirPath, const QStringList &lst,
+                                   bool *wildcardsFound)
 {
     QStringList result;
     foreach (QString str, lst) {
         if (containsWildcard(str)) {
+            *wildcardsFound = true;
             QString path = dirPath;
             str = QDir::fromNativeSeparators(str);
             int idx = str.lastIndexOf(QLatin1Char('/'));
@@ -420,7 +432,12 @@ void Parser::parseDescriptionBlock(int separatorPos, int separatorLength, int co
 
     const QStringList targets = splitTargetNames(target);
     QStringList dependents = splitTargetNames(value);
-    dependents = expandWildcards(m_makefile->dirPath(), dependents);
+    bool wildcardsFound = false;
+    dependents = expandWildcards(m_makefile->dirPath(), dependents, &wildcardsFound);
+    if (wildcardsFound) {
+        // The expansion depends on the files in the directory.
+        m_preprocessor->setCacheable(false);
+    }
 
     // handle the special .SYNC dependents
     {
@@ -547,7 +564,7 @@ void Parser::parseInlineFiles(Command& cmd, bool inferenceRule)
         readLine();
         while (!m_line.isNull()) {
             if (m_line.startsWith(QLatin1String("<<"))) {
-                QStringList options = m_line.right(m_line.length() - 2).split(m_rexSingleWhiteSpace);
+                const QStringList options = LineTokenizer::splitAtWhiteSpace(m_line.mid(2));
                 if (options.contains(QLatin1String("KEEP")))
                     inlineFile->m_keep = true;
                 if (options.contains(QLatin1String("UNICODE")))
@@ -577,16 +594,12 @@ void Parser::parseInlineFiles(Command& cmd, bool inferenceRule)
 
 void Parser::parseInferenceRule()
 {
-    QString fromPath = m_rexInferenceRule.cap(1);
-    QString fromExt  = m_rexInferenceRule.cap(2);
-    QString toPath   = m_rexInferenceRule.cap(3);
-    QString toExt    = m_rexInferenceRule.cap(4);
-    bool batchMode   = m_rexInferenceRule.cap(5).length() > 1;
-
-    if (fromPath.length() >= 2)
-        fromPath = fromPath.mid(1, fromPath.length() - 2);
-    if (toPath.length() >= 2)
-        toPath = toPath.mid(1, toPath.length() - 2);
+    QString fromPath = m_tokens.fromSearchPath;
+    QString fromExt  = m_tokens.fromExtension;
+    QString toPath   = m_tokens.toSearchPath;
+    QString toExt    = m_tokens.toExtension;
+    bool batchMode   = m_tokens.batchMode;
+
     if (fromPath.isEmpty())
         fromPath = QLatin1String(".");
     if (toPath.isEmpty())
@@ -614,12 +627,11 @@ void Parser::parseInferenceRule()
 
 void Parser::parseDotDirective()
 {
-    QString directive = m_rexDotDirective.cap(1);
-    QString value = m_rexDotDirective.cap(2);
-    //qDebug() << m_rexDotDirective.cap(1) << m_rexDotDirective.cap(2);
+    const QString &directive = m_tokens.directive;
+    const QString &value = m_tokens.value;
 
     if (directive == QLatin1String("SUFFIXES")) {
-        QStringList splitvalues = value.simplified().split(m_rexSingleWhiteSpace, QString::SkipEmptyParts);
+        QStringList splitvalues = LineTokenizer::splitAtWhiteSpace(value);
         //qDebug() << "splitvalues" << splitvalues;
         if (splitvalues.isEmpty())
             m_suffixes.clear();
@@ -629,10 +641,11 @@ void Parser::parseDotDirective()
     } else if (directive == QLatin1String("IGNORE")) {
         m_ignoreExitCodes = true;
     } else if (directive == QLatin1String("PRECIOUS")) {
-        const QStringList& splitvalues = value.split(m_rexSingleWhiteSpace);
-        foreach (QString str, splitvalues)
-            if (!str.isEmpty())
-                m_makefile->addPreciousTarget(str);
+        foreach (const QString &str, LineTokenizer::splitAtWhiteSpace(value))
+            m_makefile->addPreciousTarget(str);
+    } else if (directive == QLatin1String("RESPONSEFILES")) {
+        foreach (const QString &str, LineTokenizer::splitAtWhiteSpace(value))
+            m_makefile->addResponseFileTool(str);
     } else if (directive == QLatin1String("SILENT")) {
         m_silentCommands = true;
     }
@@ -670,10 +683,9 @@ void Parser::checkForCycles(DescriptionBlock* target)
     depth++;
 #endif
     target->m_bVisitedByCycleCheck = true;
-    for (int i = target->m_dependents.count(); --i >= 0;) {
-        DescriptionBlock *const dep = m_makefile->target(target->m_dependents.at(i));
-        checkForCycles(dep);
-    }
+    const QVector<DescriptionBlock *> dependentTargets = target->dependentTargets();
+    for (int i = dependentTargets.count(); --i >= 0;)
+        checkForCycles(dependentTargets.at(i));
     target->m_bVisitedByCycleCheck = false;
 #ifdef DEBUG_CYCLE_CHECKER
     depth--;
@@ -687,41 +699,31 @@ void Parser::resetCycleChecker(DescriptionBlock* target)
     if (!target || !target->m_bNoCyclesRootedHere)
         return;
 
-    for (int i = target->m_dependents.count(); --i >= 0;) {
-        DescriptionBlock *const dep = m_makefile->target(target->m_dependents.at(i));
-        resetCycleChecker(dep);
-    }
+    const QVector<DescriptionBlock *> dependentTargets = target->dependentTargets();
+    for (int i = dependentTargets.count(); --i >= 0;)
+        resetCycleChecker(dependentTargets.at(i));
 
     target->m_bNoCyclesRootedHere = false;
 }
 
 QVector<InferenceRule*> Parser::findRulesByTargetName(const QString& targetFilePath)
 {
-    QVector<InferenceRule *> rules;
-
-    const QHash<QString, QVector<InferenceRule *> >::const_iterator itEnd = m_ruleIdxByToExtension.constEnd();
-    for (QHash<QString, QVector<InferenceRule *> >::const_iterator it = m_ruleIdxByToExtension.constBegin(); it != itEnd; ++it) {
-        const QString &toExtension = it.key();
-        if (!targetFilePath.endsWith(toExtension, Qt::CaseInsensitive))
-            continue;
-
-        foreach (InferenceRule *rule, it.value()) {
-            if (rule->m_priority < 0)
-                continue;
-
-            QString fileName = fileNameFromFilePath(targetFilePath);
-            QString directory = targetFilePath.left(targetFilePath.length() - fileName.length());
-            removeDirSeparatorAtEnd(directory);
-            if (directory.isEmpty())
-                directory = QLatin1Char('.');
-            if (directory != rule->m_toSearchPath)
-                continue;
-
-            rules.append(rule);
-        }
-    }
-
-    return rules;
+    const QString fileName = fileNameFromFilePath(targetFilePath);
+    const int idx = fileName.lastIndexOf(QLatin1Char('.'));
+    if (idx < 0)
+        return QVector<InferenceRule *>();
+
+    const QString extension = fileName.mid(idx).toLower();
+    const QHash<QString, QHash<QString, QVector<InferenceRule *> > >::const_iterator it
+            = m_ruleIdxByToExtension.constFind(extension);
+    if (it == m_ruleIdxByToExtension.constEnd())
+        return QVector<InferenceRule *>();
+
+    QString directory = targetFilePath.left(targetFilePath.length() - fileName.length());
+    removeDirSeparatorAtEnd(directory);
+    if (directory.isEmpty())
+        directory = QLatin1Char('.');
+    return it.value().value(directory);
 }
 
 void Parser::preselectInferenceRules(DescriptionBlock *target)
@@ -735,15 +737,18 @@ void Parser::preselectInferenceRules(DescriptionBlock *target)
             target->m_inferenceRules = rules;
     }
 
-    foreach (const QString &dependentName, target->m_dependents) {
-        DescriptionBlock *dependent = m_makefile->target(dependentName);
+    // Creating targets invalidates the dependent targets. Work on a copy.
+    const QVector<DescriptionBlock *> dependentTargets = target->dependentTargets();
+    for (int i = 0; i < dependentTargets.count(); ++i) {
+        DescriptionBlock *dependent = dependentTargets.at(i);
         if (dependent) {
             preselectInferenceRules(dependent);
         } else {
-            QString dependentFileName = dependentName;
+            QString dependentFileName = target->m_dependents.at(i);
             removeDoubleQuotes(dependentFileName);
             QVector<InferenceRule *> rules = findRulesByTargetName(dependentFileName);
-            if (!rules.isEmpty()) {
+            // A duplicate of this dependent might have created the target already.
+            if (!rules.isEmpty() && !m_makefile->target(dependentFileName)) {
                 dependent = createTarget(dependentFileName);
                 dependent->m_inferenceRules = rules;
             }
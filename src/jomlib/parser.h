@@ -26,12 +26,12 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-#include <QRegExp>
 #include <QHash>
 #include <QVector>
 #include <QStack>
 #include <QStringList>
 
+#include "linetokenizer.h"
 #include "makefile.h"
 
 namespace NMakeFile {
@@ -48,14 +48,12 @@ public:
     void apply(Preprocessor* pp,
                Makefile* mkfile,
                const QStringList& activeTargets = QStringList());
+    void activateTargets(Makefile *mkfile, const QStringList &targetNames);
     MacroTable* macroTable();
 
 private:
     void readLine();
-    bool isEmptyLine(const QString& line);
     bool isDescriptionBlock(int& separatorPos, int& separatorLength, int& commandSeparatorPos);
-    bool isInferenceRule(const QString& line);
-    bool isDotDirective(const QString& line);
     DescriptionBlock* createTarget(const QString& targetName);
     void parseDescriptionBlock(int separatorPos, int separatorLength, int commandSeparatorPos);
     void parseInferenceRule();
@@ -67,6 +65,8 @@ private:
     void resetCycleChecker(DescriptionBlock* target);
     QVector<InferenceRule*> findRulesByTargetName(const QString& targetFilePath);
     void preselectInferenceRules(DescriptionBlock *target);
+    void checkTargetsExist(const QStringList &targetNames);
+    void prepareTargets(const QStringList &targetNames);
     void error(const QString& msg);
 
 private:
@@ -75,15 +75,15 @@ private:
     bool                        m_silentCommands;
     bool                        m_ignoreExitCodes;
 
-    QRegExp                     m_rexDotDirective;
-    QRegExp                     m_rexInferenceRule;
-    QRegExp                     m_rexSingleWhiteSpace;
+    LineTokenizer::Tokens       m_tokens;
 
     Makefile*                   m_makefile;
     QStringList                 m_suffixes;
     QStringList                 m_activeTargets;
     QHash<QString, QStringList> m_syncPoints;
-    QHash<QString, QVector<InferenceRule *> > m_ruleIdxByToExtension;
+
+    // lower case target extension -> target search path -> rules
+    QHash<QString, QHash<QString, QVector<InferenceRule *> > > m_ruleIdxByToExtension;
 };
 
 } // namespace NMakeFile
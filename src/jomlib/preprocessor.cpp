@@ -29,6 +29,8 @@
 #include "exception.h"
 #include "helperfunctions.h"
 #include "fastfileinfo.h"
+#include "linetokenizer.h"
+#include "includeprefetcher.h"
 
 #include <QDir>
 #include <QDebug>
@@ -38,14 +40,16 @@ namespace NMakeFile {
 Preprocessor::Preprocessor()
 :   m_macroTable(0),
     m_expressionParser(0),
-    m_bInlineFileMode(false)
+    m_includePrefetcher(new IncludePrefetcher),
+    m_bInlineFileMode(false),
+    m_bCacheable(true)
 {
-    m_rexPreprocessingDirective.setPattern(QLatin1String("^!\\s*(\\S+)(.*)"));
 }
 
 Preprocessor::~Preprocessor()
 {
     delete m_expressionParser;
+    delete m_includePrefetcher;
 }
 
 void Preprocessor::setMacroTable(MacroTable* macroTable)
@@ -60,6 +64,9 @@ bool Preprocessor::openFile(const QString& fileName)
     m_conditionalStack.clear();
     if (!m_fileStack.isEmpty())
         m_fileStack.clear();
+    m_openedFiles.clear();
+    m_missingIncludeFiles.clear();
+    m_bCacheable = true;
 
     return internalOpenFile(fileName);
 }
@@ -81,11 +88,13 @@ bool Preprocessor::internalOpenFile(QString fileName)
             error(QLatin1String("cycle in include files: ") + fileInfo.fileName());
 
     MakefileLineReader* reader = new MakefileLineReader(fileName);
+    reader->setDecodedContent(m_includePrefetcher->take(fileName));
     if (!reader->open()) {
         delete reader;
         error(QLatin1Literal("Can't open ") + origFileName);
     }
 
+    m_openedFiles.append(fileName);
     m_fileStack.push(TextFile());
     TextFile& textFile = m_fileStack.top();
     textFile.reader = reader;
@@ -93,6 +102,15 @@ bool Preprocessor::internalOpenFile(QString fileName)
     return true;
 }
 
+/**
+ * Starts reading the given files in the background, e.g. the files that
+ * were read for the same makefile before.
+ */
+void Preprocessor::prefetchFiles(const QStringList& filePaths)
+{
+    m_includePrefetcher->prefetch(filePaths);
+}
+
 QString Preprocessor::readLine()
 {
     MakefileLine line;
@@ -209,10 +227,12 @@ bool Preprocessor::parseMacro(const QString& line)
     if (line.isEmpty())
         return false;
 
-    static const QRegExp rex(QLatin1String("^(?:_|[a-z]|[0-9]|\\$)(?:[a-z]|[0-9]|\\$|=|\\()?"),
-                             Qt::CaseInsensitive, QRegExp::RegExp2);
-    if (rex.indexIn(line) != 0)
+    // A macro name starts with _, $, a letter or a digit.
+    const ushort firstChar = line.at(0).unicode();
+    if (!(firstChar == '_' || firstChar == '$' || (firstChar >= '0' && firstChar <= '9')
+          || (firstChar >= 'a' && firstChar <= 'z') || (firstChar >= 'A' && firstChar <= 'Z'))) {
         return false;
+    }
 
     int equalsSignPos = -1;
     int parenthesisDepth = 0;
@@ -248,14 +268,15 @@ bool Preprocessor::parseMacro(const QString& line)
 bool Preprocessor::parsePreprocessingDirective(const QString& line)
 {
     QString directive, value;
-    QString expandedLine = m_macroTable->expandMacros(line);
-    if (!isPreprocessingDirective(expandedLine, directive, value))
+    if (!isPreprocessingDirective(line, directive, value))
         return false;
 
     if (directive == QLatin1String("CMDSWITCHES")) {
     } else if (directive == QLatin1String("ERROR")) {
         error(QLatin1Literal("ERROR: ") + value);
     } else if (directive == QLatin1String("MESSAGE")) {
+        // A cached makefile would not print the message.
+        m_bCacheable = false;
         puts(qPrintable(value));
     } else if (directive == QLatin1String("INCLUDE")) {
         internalOpenFile(findIncludeFile(value));
@@ -335,6 +356,7 @@ QString Preprocessor::findIncludeFile(const QString &filePathToInclude)
     QFileInfo fi(filePath);
     if (fi.exists())
         return fi.absoluteFilePath();
+    m_missingIncludeFiles.append(fi.absoluteFilePath());
 
     // Search recursively through all directories of all parent makefiles.
     for (QStack<TextFile>::const_iterator it = m_fileStack.constEnd();
@@ -343,6 +365,7 @@ QString Preprocessor::findIncludeFile(const QString &filePathToInclude)
         fi.setFile(it->fileDirectory + QLatin1Char('/') + filePath);
         if (fi.exists())
             return fi.absoluteFilePath();
+        m_missingIncludeFiles.append(fi.absoluteFilePath());
     }
 
     if (angleBrackets) {
@@ -354,6 +377,7 @@ QString Preprocessor::findIncludeFile(const QString &filePathToInclude)
             fi.setFile(includeDir + QLatin1Char('/') + filePath);
             if (fi.exists())
                 return fi.absoluteFilePath();
+            m_missingIncludeFiles.append(fi.absoluteFilePath());
         }
     }
 
@@ -362,7 +386,76 @@ QString Preprocessor::findIncludeFile(const QString &filePathToInclude)
     return QString();
 }
 
+/**
+ * Splits the unexpanded line into the directive and its unexpanded value.
+ *
+ * Macro expansion does not touch the characters in front of the first macro
+ * invocation. Therefore the directive can be read from the raw line, unless
+ * a macro invocation is part of the directive itself. For such lines
+ * AmbiguousDirective is returned and the caller must expand the line first.
+ */
+Preprocessor::DirectiveKind Preprocessor::splitRawPreprocessingDirective(const QString& line,
+                                                                          QString& directive,
+                                                                          QString& value)
+{
+    if (line.isEmpty())
+        return NoDirective;
+
+    const QChar firstChar = line.at(0);
+    if (firstChar == QLatin1Char('!')) {
+        if (!LineTokenizer::isPreprocessingDirective(line, &directive, &value))
+            return NoDirective;
+        if (directive.contains(QLatin1Char('$'))
+                || (directive == QLatin1String("ELSE") && value.contains(QLatin1Char('$')))) {
+            return AmbiguousDirective;
+        }
+        return RawDirective;
+    }
+
+    // Command lines and the like.
+    if (isSpaceOrTab(firstChar))
+        return NoDirective;
+
+    // Old style include directive.
+    const QString includeKeyword = QLatin1String("include");
+    const int dollarPos = line.indexOf(QLatin1Char('$'));
+    if (dollarPos >= 0 && includeKeyword.startsWith(line.left(dollarPos), Qt::CaseInsensitive))
+        return AmbiguousDirective;
+    if (line.length() <= 8 || !isSpaceOrTab(line.at(7))
+            || line.left(7).toLower() != includeKeyword) {
+        return NoDirective;
+    }
+    if (dollarPos >= 0)
+        return AmbiguousDirective;
+    directive = QLatin1String("INCLUDE");
+    value = line.mid(8);
+    return RawDirective;
+}
+
+/**
+ * Returns true if the unexpanded line is a preprocessing directive.
+ * Only the value of the directive is macro expanded, except for the rare lines
+ * where a macro invocation may change the directive.
+ */
 bool Preprocessor::isPreprocessingDirective(const QString& line, QString& directive, QString& value)
+{
+    switch (splitRawPreprocessingDirective(line, directive, value)) {
+    case NoDirective:
+        return false;
+    case AmbiguousDirective:
+        return isExpandedPreprocessingDirective(m_macroTable->expandMacros(line), directive, value);
+    case RawDirective:
+        break;
+    }
+
+    if (value.contains(QLatin1Char('$')))
+        value = m_macroTable->expandMacros(value).trimmed();
+    value = expandDirectiveValue(value);
+    removeInlineComments(value);
+    return true;
+}
+
+bool Preprocessor::isExpandedPreprocessingDirective(const QString& line, QString& directive, QString& value)
 {
     if (line.isEmpty())
         return false;
@@ -388,28 +481,26 @@ bool Preprocessor::isPreprocessingDirective(const QString& line, QString& direct
         directive = QLatin1String("INCLUDE");
         value = line.mid(8);
     } else {
-        result = m_rexPreprocessingDirective.exactMatch(line);
-        if (result) {
-            directive = m_rexPreprocessingDirective.cap(1).toUpper();
-            value = m_rexPreprocessingDirective.cap(2).trimmed();
-
-            // Handle "!else if", "!else ifdef", "!else ifndef" as "!ELSEIF" etc.
-            if (directive == QLatin1String("ELSE")) {
-                static const QRegExp rex(QLatin1String("^(ifn?def|if)\\s+(.*)$"),
-                                         Qt::CaseInsensitive);
-                if (rex.exactMatch(value)) {
-                    directive.append(rex.cap(1).toUpper());
-                    value = rex.cap(2);
-                }
-            }
-        }
+        result = LineTokenizer::isPreprocessingDirective(line, &directive, &value);
     }
 
-    value = m_macroTable->expandMacros(value);
+    value = expandDirectiveValue(value);
     removeInlineComments(value);
     return result;
 }
 
+/**
+ * The value of a directive has always been expanded a second time after the
+ * whole line was expanded. This only makes a difference for values that
+ * still contain a dollar sign, e.g. from an escaped $$.
+ */
+QString Preprocessor::expandDirectiveValue(const QString& value)
+{
+    if (!value.contains(QLatin1Char('$')))
+        return value;
+    return m_macroTable->expandMacros(value);
+}
+
 void Preprocessor::skipUntilNextMatchingConditional()
 {
     uint depth = 0;
@@ -426,9 +517,20 @@ void Preprocessor::skipUntilNextMatchingConditional()
         if (line.content.startsWith(QLatin1Char('!')))
             completePreprocessingDirectiveLine(line);
 
-        QString expandedLine = m_macroTable->expandMacros(line.content);
-        if (!isPreprocessingDirective(expandedLine, directive, value))
+        // Skipped lines are not expanded, unless a macro invocation may change
+        // the directive itself.
+        QString directiveLine = line.content;
+        switch (splitRawPreprocessingDirective(directiveLine, directive, value)) {
+        case NoDirective:
             continue;
+        case AmbiguousDirective:
+            directiveLine = m_macroTable->expandMacros(directiveLine);
+            if (!LineTokenizer::isPreprocessingDirective(directiveLine, &directive, &value))
+                continue;
+            break;
+        case RawDirective:
+            break;
+        }
 
         if (directive == QLatin1String("ENDIF"))
             token = TOK_ENDIF;
@@ -444,7 +546,7 @@ void Preprocessor::skipUntilNextMatchingConditional()
 
         if (depth == 0) {
             if (token == TOK_ELSE) {
-                m_linesPutBack.append(expandedLine);
+                m_linesPutBack.append(directiveLine);
                 return;  // found the next matching ELSE
             }
             if (token == TOK_ENDIF) {
@@ -480,7 +582,15 @@ int Preprocessor::evaluateExpression(const QString& expr)
         m_expressionParser->setMacroTable(m_macroTable);
     }
 
-    if (!m_expressionParser->parse(qPrintable(m_macroTable->expandMacros(expr)))) {
+    const QString expandedExpr = m_macroTable->expandMacros(expr);
+
+    // EXIST and shell commands depend on the state of the system.
+    if (expandedExpr.contains(QLatin1Char('['))
+            || expandedExpr.contains(QLatin1String("EXIST"), Qt::CaseInsensitive)) {
+        m_bCacheable = false;
+    }
+
+    if (!m_expressionParser->parse(qPrintable(expandedExpr))) {
         QString msg = QLatin1String("Can't evaluate preprocessor expression.");
         msg += QLatin1String("\nerror: ");
         msg += QString::fromLatin1(m_expressionParser->errorMessage());
@@ -28,7 +28,6 @@
 
 #include "makefilelinereader.h"
 
-#include <QRegExp>
 #include <QStack>
 #include <QStringList>
 
@@ -36,6 +35,7 @@ class PPExprParser;
 
 namespace NMakeFile {
 
+class IncludePrefetcher;
 class MacroTable;
 class MakefileLineReader;
 
@@ -48,6 +48,7 @@ public:
     void setMacroTable(MacroTable* macroTable);
     MacroTable* macroTable() { return m_macroTable; }
     bool openFile(const QString& filename);
+    void prefetchFiles(const QStringList& filePaths);
     QString readLine();
     uint lineNumber() const;
     QString currentFileName() const;
@@ -55,6 +56,16 @@ public:
     bool isInlineFileMode() const { return m_bInlineFileMode; }
     void setInlineFileModeEnabled(bool enabled) { m_bInlineFileMode = enabled; }
 
+    /**
+     * Returns false, if the result of preprocessing depends on anything else than
+     * the macro table and the makefiles read. E.g. on existing files or shell commands.
+     * Such makefiles must not be stored in the MakefileCache.
+     */
+    bool isCacheable() const { return m_bCacheable; }
+    void setCacheable(bool cacheable) { m_bCacheable = cacheable; }
+    const QStringList& openedFiles() const { return m_openedFiles; }
+    const QStringList& missingIncludeFiles() const { return m_missingIncludeFiles; }
+
     static void removeInlineComments(QString& line);
 
 private:
@@ -69,7 +80,11 @@ private:
     bool parseMacro(const QString& line);
     bool parsePreprocessingDirective(const QString& line);
     QString findIncludeFile(const QString &filePathToInclude);
+    enum DirectiveKind { NoDirective, RawDirective, AmbiguousDirective };
+    DirectiveKind splitRawPreprocessingDirective(const QString& line, QString& directive, QString& value);
     bool isPreprocessingDirective(const QString& line, QString& directive, QString& value);
+    bool isExpandedPreprocessingDirective(const QString& line, QString& directive, QString& value);
+    QString expandDirectiveValue(const QString& value);
     void skipUntilNextMatchingConditional();
     void error(const QString& msg);
     void enterConditional(bool followElseBranch);
@@ -100,11 +115,14 @@ private:
 
     QStack<TextFile>    m_fileStack;
     MacroTable*         m_macroTable;
-    QRegExp             m_rexPreprocessingDirective;
     QStack<bool>        m_conditionalStack;
     PPExprParser*       m_expressionParser;
+    IncludePrefetcher*  m_includePrefetcher;
     QStringList         m_linesPutBack;
+    QStringList         m_openedFiles;
+    QStringList         m_missingIncludeFiles;
     bool                m_bInlineFileMode;
+    bool                m_bCacheable;
 };
 
 } //namespace NMakeFile
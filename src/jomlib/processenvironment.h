@@ -68,6 +68,51 @@ inline bool operator < (const ProcessEnvironmentKey &lhs, const ProcessEnvironme
 
 typedef QMap<ProcessEnvironmentKey, QString> ProcessEnvironment;
 
+/**
+ * Process environment that is shared by all command executors of a build.
+ *
+ * The environment is never modified in place. Every change publishes a new
+ * environment and increments the version number. Users of this class can
+ * cache data that is derived from the environment (e.g. the native
+ * environment block) and rebuild it when the version changes.
+ */
+class SharedProcessEnvironment
+{
+public:
+    explicit SharedProcessEnvironment(const ProcessEnvironment &environment)
+        : m_environment(environment)
+        , m_version(1)
+    {
+    }
+
+    const ProcessEnvironment &environment() const
+    {
+        return m_environment;
+    }
+
+    uint version() const
+    {
+        return m_version;
+    }
+
+    void publish(const ProcessEnvironment &environment)
+    {
+        m_environment = environment;
+        ++m_version;
+    }
+
+    void publish(const QString &name, const QString &value)
+    {
+        ProcessEnvironment environment = m_environment;
+        environment.insert(name, value);
+        publish(environment);
+    }
+
+private:
+    ProcessEnvironment m_environment;
+    uint m_version;
+};
+
 } // namespace NMakeFile
 
 #endif // PROCESSENVIRONMENT_H
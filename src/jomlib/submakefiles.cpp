@@ -0,0 +1,237 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#include "submakefiles.h"
+#include "commandexecutor.h"
+#include "exception.h"
+#include "macrotable.h"
+#include "makefile.h"
+#include "makefilefactory.h"
+#include "nestedbuild.h"
+#include "options.h"
+#include "parser.h"
+
+#include <QtCore/QFileInfo>
+
+namespace NMakeFile {
+
+SubMakefiles::SubMakefiles(Makefile *rootMakefile, const SharedProcessEnvironment *environment)
+    : m_rootMakefile(rootMakefile)
+    , m_environment(environment)
+{
+}
+
+SubMakefiles::~SubMakefiles()
+{
+    foreach (const Entry &entry, m_entries)
+        delete entry.makefile;
+}
+
+/**
+ * Parses the makefiles of all sub-make targets that can be reached from root.
+ * The dependents are followed within the makefile of each target. Throws an
+ * Exception, if a makefile cannot be parsed.
+ */
+void SubMakefiles::load(DescriptionBlock *root)
+{
+    QSet<DescriptionBlock *> visited;
+    QList<DescriptionBlock *> stack;
+    stack.append(root);
+    while (!stack.isEmpty()) {
+        DescriptionBlock *target = stack.takeLast();
+        if (visited.contains(target))
+            continue;
+        visited.insert(target);
+
+        if (expand(target))
+            stack += m_goals.value(target);
+        foreach (DescriptionBlock *dependent, target->dependentTargets()) {
+            if (dependent)
+                stack.append(dependent);
+        }
+    }
+}
+
+/**
+ * Turns target into a sub-make target, if all of its commands are jom calls
+ * that can be merged. Commands with file name macros, inline files or
+ * ignored exit codes are run as usual, as are calls of makefiles that
+ * disable parallel execution.
+ */
+bool SubMakefiles::expand(DescriptionBlock *target)
+{
+    if (m_goals.contains(target))
+        return true;
+    if (m_plainTargets.contains(target) || target->m_commands.isEmpty())
+        return false;
+
+    QList<QStringList> argumentLists;
+    QList<int> targetCounts;
+    foreach (const Command &cmd, target->m_commands) {
+        QString commandLine = cmd.m_commandLine;
+        commandLine.replace(QLatin1String("%%"), QLatin1String("%"));
+        QStringList arguments;
+        int targetCount;
+        if (!cmd.m_inlineFiles.isEmpty() || cmd.m_maxExitCode != 0
+                || commandLine.contains(QLatin1Char('$'))
+                || commandLine.contains(MacroTable::fileNameMacroMagicEscape)
+                || !CommandExecutor::isSimpleCommandLine(commandLine)
+                || !NestedBuild::parseCommandLine(commandLine, target->makefile()->options(),
+                                                  m_environment->environment(), &arguments,
+                                                  &targetCount)) {
+            m_plainTargets.insert(target);
+            return false;
+        }
+        argumentLists.append(arguments);
+        targetCounts.append(targetCount);
+    }
+
+    QList<DescriptionBlock *> goals;
+    for (int i = 0; i < argumentLists.count(); ++i) {
+        QStringList activeTargets;
+        Makefile *makefile = loadMakefile(argumentLists.at(i), targetCounts.at(i),
+                                          &activeTargets);
+        if (makefile->isParallelExecutionDisabled()) {
+            m_plainTargets.insert(target);
+            return false;
+        }
+
+        if (activeTargets.isEmpty()) {
+            if (makefile->firstTarget())
+                goals.append(makefile->firstTarget());
+            continue;
+        }
+        foreach (const QString &targetName, activeTargets) {
+            DescriptionBlock *goal = makefile->target(targetName);
+            if (!goal) {
+                QString msg = QLatin1String("Target %1 does not exist in %2.");
+                throw Exception(msg.arg(targetName, makefile->fileName()));
+            }
+            goals.append(goal);
+        }
+    }
+
+    target->m_commands.clear();
+    m_goals.insert(target, goals);
+    return true;
+}
+
+/**
+ * Parses the makefile of a jom call. The last targetCount arguments are the
+ * targets of the call.
+ *
+ * Calls of the same makefile with the same options and macros share one
+ * Makefile object, no matter which targets they build. The targets of
+ * further calls are prepared for execution on the shared object. Targets
+ * that do not exist are left to the caller.
+ */
+Makefile *SubMakefiles::loadMakefile(const QStringList &arguments, int targetCount,
+                                     QStringList *activeTargets)
+{
+    QString fileName;
+    Options options;
+    MacroTable macroTable;
+    activeTargets->clear();
+    if (!options.readCommandLineArguments(arguments, fileName, *activeTargets, macroTable)) {
+        QString msg = QLatin1String("Invalid arguments for sub-make: %1");
+        throw Exception(msg.arg(arguments.join(QLatin1Char(' '))));
+    }
+
+    const QStringList settings = arguments.mid(0, arguments.count() - targetCount);
+    const QString key = QFileInfo(fileName).absoluteFilePath().toLower()
+            + QLatin1Char('\n') + settings.join(QLatin1Char('\n'));
+    QHash<QString, Entry>::iterator it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        QStringList targetNames;
+        if (activeTargets->isEmpty() && it->makefile->firstTarget())
+            targetNames.append(it->makefile->firstTarget()->targetName());
+        foreach (const QString &targetName, *activeTargets) {
+            if (it->makefile->target(targetName))
+                targetNames.append(targetName);
+        }
+        QStringList newTargetNames;
+        foreach (const QString &targetName, targetNames) {
+            if (!it->activatedTargets.contains(targetName)) {
+                newTargetNames.append(targetName);
+                it->activatedTargets.insert(targetName);
+            }
+        }
+        if (!newTargetNames.isEmpty()) {
+            Parser parser;
+            parser.activateTargets(it->makefile, newTargetNames);
+        }
+        return it->makefile;
+    }
+
+    MakefileFactory factory;
+    Options *factoryOptions = 0;
+    factory.setEnvironment(m_environment->environment());
+    if (!factory.apply(arguments, &factoryOptions)) {
+        if (factory.makefile())
+            delete factory.makefile();
+        else
+            delete factoryOptions;
+        if (factory.errorType() == MakefileFactory::CommandLineError) {
+            QString msg = QLatin1String("Invalid arguments for sub-make: %1");
+            throw Exception(msg.arg(arguments.join(QLatin1Char(' '))));
+        }
+        throw Exception(factory.errorString());
+    }
+
+    Entry entry;
+    entry.makefile = factory.makefile();
+    foreach (const QString &targetName, factory.activeTargets())
+        entry.activatedTargets.insert(targetName);
+    if (factory.activeTargets().isEmpty() && entry.makefile->firstTarget())
+        entry.activatedTargets.insert(entry.makefile->firstTarget()->targetName());
+    m_entries.insert(key, entry);
+    if (!entry.makefile->isParallelExecutionDisabled())
+        m_makefiles.append(entry.makefile);
+    return entry.makefile;
+}
+
+/**
+ * Looks up a target in the calling makefile and the merged makefiles,
+ * except in exclude.
+ */
+DescriptionBlock *SubMakefiles::findTarget(const QString &name, const Makefile *exclude) const
+{
+    DescriptionBlock *target = 0;
+    if (m_rootMakefile != exclude)
+        target = m_rootMakefile->target(name);
+    for (int i = 0; !target && i < m_makefiles.count(); ++i) {
+        if (m_makefiles.at(i) != exclude)
+            target = m_makefiles.at(i)->target(name);
+    }
+    return target;
+}
+
+void SubMakefiles::invalidateTimeStamps()
+{
+    foreach (Makefile *makefile, m_makefiles)
+        makefile->invalidateTimeStamps();
+}
+
+} // namespace NMakeFile
@@ -0,0 +1,89 @@
+/****************************************************************************
+**
+** Copyright (C) 2016 The Qt Company Ltd.
+** Contact: https://www.qt.io/licensing/
+**
+** This file is part of jom.
+**
+** Commercial License Usage
+** Licensees holding valid commercial Qt licenses may use this file in
+** accordance with the commercial license agreement provided with the
+** Software or, alternatively, in accordance with the terms contained in
+** a written agreement between you and The Qt Company. For licensing terms
+** and conditions see https://www.qt.io/terms-conditions. For further
+** information use the contact form at https://www.qt.io/contact-us.
+**
+** GNU General Public License Usage
+** Alternatively, this file may be used under the terms of the GNU
+** General Public License version 3 as published by the Free Software
+** Foundation with exceptions as appearing in the file LICENSE.GPL3-EXCEPT
+** included in the packaging of this file. Please review the following
+** information to ensure the GNU General Public License requirements will
+** be met: https://www.gnu.org/licenses/gpl-3.0.html.
+**
+****************************************************************************/
+
+#ifndef SUBMAKEFILES_H
+#define SUBMAKEFILES_H
+
+#include "processenvironment.h"
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+
+namespace NMakeFile {
+
+class DescriptionBlock;
+class Makefile;
+
+/**
+ * The makefiles of recursive jom calls that are merged into the dependency
+ * graph of the calling build.
+ *
+ * A target whose commands all call this jom executable (see
+ * NestedBuild::parseCommandLine) is a sub-make target. The makefiles of its
+ * calls are parsed up front. The target loses its commands and gets the
+ * targets that the calls would build as goals instead.
+ *
+ * Every parsed makefile keeps its own targets, macros, inference rules and
+ * options, i.e. its targets live in the namespace of their makefile.
+ * Dependents that are not defined in a target's own makefile are looked up
+ * in the other merged makefiles. That way a target waits for the targets of
+ * another sub-make it depends on, not for the whole sub-make.
+ */
+class SubMakefiles
+{
+public:
+    SubMakefiles(Makefile *rootMakefile, const SharedProcessEnvironment *environment);
+    ~SubMakefiles();
+
+    void load(DescriptionBlock *root);
+    bool isSubMakeTarget(DescriptionBlock *target) const { return m_goals.contains(target); }
+    QList<DescriptionBlock *> goals(DescriptionBlock *target) const { return m_goals.value(target); }
+    DescriptionBlock *findTarget(const QString &name, const Makefile *exclude) const;
+    const QList<Makefile *> &makefiles() const { return m_makefiles; }
+    void invalidateTimeStamps();
+
+private:
+    bool expand(DescriptionBlock *target);
+    Makefile *loadMakefile(const QStringList &arguments, int targetCount,
+                           QStringList *activeTargets);
+
+    struct Entry
+    {
+        Makefile *makefile;
+        QSet<QString> activatedTargets;
+    };
+
+    Makefile *m_rootMakefile;
+    const SharedProcessEnvironment *m_environment;
+    QHash<QString, Entry> m_entries;
+    QList<Makefile *> m_makefiles;
+    QHash<DescriptionBlock *, QList<DescriptionBlock *> > m_goals;
+    QSet<DescriptionBlock *> m_plainTargets;
+};
+
+} // namespace NMakeFile
+
+#endif // SUBMAKEFILES_H
@@ -25,12 +25,19 @@
 
 #include "targetexecutor.h"
 #include "commandexecutor.h"
+#include "consolewriter.h"
 #include "dependencygraph.h"
 #include "jobclient.h"
 #include "options.h"
+#include "outputbuffer.h"
+#include "submakefiles.h"
 #include "exception.h"
 
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QTextStream>
 #include <QCoreApplication>
 
@@ -38,33 +45,36 @@ namespace NMakeFile {
 
 TargetExecutor::TargetExecutor(const ProcessEnvironment &environment)
     : m_environment(environment)
+    , m_sharedEnvironment(environment)
+    , m_subMakefiles(0)
     , m_jobClient(0)
+    , m_resourceReport(0)
+    , m_orderedOutput(false)
+    , m_forwardOutput(false)
+    , m_maxNumberOfJobs(g_options.maxNumberOfJobs)
+    , m_outputOrderPos(0)
+    , m_heldOutputMemorySize(0)
     , m_bAborted(false)
     , m_allCommandsSuccessfullyExecuted(true)
 {
     m_makefile = 0;
     m_depgraph = new DependencyGraph();
 
-    for (int i = 0; i < g_options.maxNumberOfJobs; ++i) {
-        CommandExecutor* executor = new CommandExecutor(this, environment);
-        connect(executor, SIGNAL(finished(CommandExecutor*, bool)),
-                this, SLOT(onChildFinished(CommandExecutor*, bool)));
+    // Command executors are created on demand. Idle ones are released after a while.
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(5000);
+    connect(&m_idleTimer, &QTimer::timeout, this, &TargetExecutor::releaseIdleExecutors);
 
-        foreach (CommandExecutor *other, m_processes) {
-            connect(executor, SIGNAL(environmentChanged(const ProcessEnvironment &)),
-                    other, SLOT(setEnvironment(const ProcessEnvironment &)));
-            connect(other, SIGNAL(environmentChanged(const ProcessEnvironment &)),
-                    executor, SLOT(setEnvironment(const ProcessEnvironment &)));
-        }
-        m_processes.append(executor);
-    }
-    m_availableProcesses = m_processes;
-    m_availableProcesses.first()->setBufferedOutput(false);
+    // Looks for new targets when the batch window has elapsed.
+    m_batchWindowTimer.setSingleShot(true);
+    connect(&m_batchWindowTimer, &QTimer::timeout, this, &TargetExecutor::startProcesses);
 }
 
 TargetExecutor::~TargetExecutor()
 {
     delete m_depgraph;
+    delete m_subMakefiles;
+    qDeleteAll(m_heldOutput);
 }
 
 void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
@@ -74,6 +84,7 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
     m_makefile = mkfile;
     m_jobAcquisitionCount = 0;
     m_nextTarget = 0;
+    m_maxNumberOfJobs = mkfile->isParallelExecutionDisabled() ? 1 : g_options.maxNumberOfJobs;
 
     if (!m_jobClient) {
         m_jobClient = new JobClient(&m_environment, this);
@@ -84,6 +95,33 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
         connect(m_jobClient, &JobClient::acquired, this, &TargetExecutor::buildNextTarget);
     }
 
+    if (!mkfile->options()->logDirectory.isEmpty()) {
+        m_logDirectory = QDir(mkfile->options()->logDirectory).absolutePath();
+        if (!QDir().mkpath(m_logDirectory)) {
+            const QString msg = QLatin1String("Can't create log directory %1.");
+            throw Exception(msg.arg(QDir::toNativeSeparators(m_logDirectory)));
+        }
+    }
+
+    if (mkfile->options()->globalGraph && !m_subMakefiles) {
+        m_subMakefiles = new SubMakefiles(mkfile, &m_sharedEnvironment);
+        m_depgraph->setSubMakefiles(m_subMakefiles);
+    }
+
+    // Log files take precedence over ordered output.
+    m_orderedOutput = mkfile->options()->orderedOutput && m_logDirectory.isEmpty();
+
+    if (!m_resourceReport && !mkfile->options()->resourceReportFile.isEmpty()) {
+        m_resourceReport = new QFile(mkfile->options()->resourceReportFile, this);
+        if (!m_resourceReport->open(QFile::WriteOnly | QFile::Truncate)) {
+            const QString msg = QLatin1String("Can't open resource report file %1 for writing.");
+            const QString fileName = m_resourceReport->fileName();
+            delete m_resourceReport;
+            m_resourceReport = 0;
+            throw Exception(msg.arg(fileName));
+        }
+    }
+
     DescriptionBlock* descblock;
     if (targets.isEmpty()) {
         if (mkfile->targets().isEmpty()) {
@@ -103,7 +141,8 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
         }
     }
 
-    m_depgraph->build(descblock);
+    if (!buildDependencyGraph(descblock))
+        return;
     if (m_makefile->options()->dumpDependencyGraph) {
         if (m_makefile->options()->dumpDependencyGraphDot)
             m_depgraph->dotDump();
@@ -118,12 +157,19 @@ void TargetExecutor::apply(Makefile* mkfile, const QStringList& targets)
 
 void TargetExecutor::startProcesses()
 {
-    if (m_bAborted || m_jobClient->isAcquiring() || m_availableProcesses.isEmpty())
+    if (m_bAborted || m_jobClient->isAcquiring() || !isExecutorAvailable())
         return;
 
     try {
         if (!m_nextTarget)
             findNextTarget();
+        if (!m_nextTarget && !m_batchWindowTimer.isActive()) {
+            const int batchWindowTime = remainingBatchWindowTime();
+            if (batchWindowTime >= 0)
+                m_batchWindowTimer.start(batchWindowTime);
+        }
+        if (m_orderedOutput)
+            releaseOrderedOutput();
 
         if (m_nextTarget) {
             if (numberOfRunningProcesses() == 0) {
@@ -141,18 +187,43 @@ void TargetExecutor::startProcesses()
                 } else {
                     m_depgraph->clear();
                     m_makefile->invalidateTimeStamps();
-                    m_depgraph->build(m_pendingTargets.takeFirst());
+                    if (m_subMakefiles)
+                        m_subMakefiles->invalidateTimeStamps();
+                    if (!buildDependencyGraph(m_pendingTargets.takeFirst()))
+                        return;
                     QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
                 }
             }
         }
     } catch (Exception &e) {
         m_bAborted = true;
-        fprintf(stderr, "Error: %s\n", qPrintable(e.message()));
+        writeError("Error: " + e.message().toLocal8Bit() + '\n');
         finishBuild(1);
     }
 }
 
+/**
+ * Returns the time until the first batch window of the makefiles in the graph closes.
+ * Returns -1, if none of these makefiles has pending batch mode targets.
+ */
+int TargetExecutor::remainingBatchWindowTime() const
+{
+    QList<Makefile *> makefiles;
+    makefiles << m_makefile;
+    if (m_subMakefiles)
+        makefiles += m_subMakefiles->makefiles();
+
+    int result = -1;
+    foreach (Makefile *mkfile, makefiles) {
+        if (!mkfile->hasPendingBatchModeTargets())
+            continue;
+        const int remainingTime = mkfile->remainingBatchWindowTime();
+        if (result < 0 || remainingTime < result)
+            result = remainingTime;
+    }
+    return result;
+}
+
 void TargetExecutor::buildNextTarget()
 {
     Q_ASSERT(m_nextTarget);
@@ -161,13 +232,14 @@ void TargetExecutor::buildNextTarget()
         return;
 
     try {
-        CommandExecutor *executor = m_availableProcesses.takeFirst();
+        CommandExecutor *executor = m_availableProcesses.isEmpty()
+                ? createExecutor() : m_availableProcesses.takeFirst();
         executor->start(m_nextTarget);
         m_nextTarget = 0;
         QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
     } catch (const Exception &e) {
         m_bAborted = true;
-        fprintf(stderr, "Error: %s\n", qPrintable(e.message()));
+        writeError("Error: " + e.message().toLocal8Bit() + '\n');
         finishBuild(1);
     }
 }
@@ -197,6 +269,7 @@ void TargetExecutor::finishBuild(int exitCode)
         // /k specified and some command failed
         exitCode = 1;
     }
+    ConsoleWriter::instance()->flush();
     emit finished(exitCode);
 }
 
@@ -211,8 +284,8 @@ void TargetExecutor::findNextTarget()
                 continue;
             } else if (m_makefile->options()->buildUnrelatedTargetsOnError
                        && m_depgraph->isUnbuildable(m_nextTarget)) {
-                fprintf(stderr, "jom: Target '%s' cannot be built due to failed dependencies.\n",
-                        qPrintable(m_nextTarget->targetName()));
+                writeError("jom: Target '" + m_nextTarget->targetName().toLocal8Bit()
+                           + "' cannot be built due to failed dependencies.\n");
                 m_depgraph->removeLeaf(m_nextTarget);
                 continue;
             }
@@ -230,17 +303,26 @@ void TargetExecutor::onChildFinished(CommandExecutor* executor, bool commandFail
             // Recursively mark all parents of this node as unbuildable due to unsatisfied
             // dependencies. This must happen before removing the node from the build graph.
             m_depgraph->markParentsRecursivlyUnbuildable(executor->target());
-            fputs("jom: Option /K specified. Continuing.\n", stderr);
+            writeError("jom: Option /K specified. Continuing.\n");
         }
     }
+    if (m_resourceReport)
+        writeResourceReport(executor, commandFailed);
+    if (m_orderedOutput)
+        holdOrderedOutput(executor);
+    else if (m_forwardOutput)
+        forwardOutput(executor);
     FastFileInfo::clearCacheForFile(executor->target()->targetName());
     m_depgraph->removeLeaf(executor->target());
+    if (m_orderedOutput)
+        releaseOrderedOutput();
     if (m_jobAcquisitionCount > 0) {
         m_jobClient->release();
         m_jobAcquisitionCount--;
     }
     m_availableProcesses.append(executor);
-    if (!executor->isBufferedOutputSet()) {
+    if (!executor->isBufferedOutputSet() && m_logDirectory.isEmpty()
+            && !m_makefile->options()->lineOutput && !m_forwardOutput) {
         executor->setBufferedOutput(true);
         bool found = false;
         foreach (CommandExecutor *cmdex, m_processes) {
@@ -252,6 +334,7 @@ void TargetExecutor::onChildFinished(CommandExecutor* executor, bool commandFail
         if (!found)
             m_availableProcesses.first()->setBufferedOutput(false);
     }
+    m_idleTimer.start();
 
     bool abortMakeProcess = commandFailed && !m_makefile->options()->buildUnrelatedTargetsOnError;
     if (abortMakeProcess) {
@@ -260,12 +343,238 @@ void TargetExecutor::onChildFinished(CommandExecutor* executor, bool commandFail
         m_pendingTargets.clear();
         waitForProcesses();
         waitForJobClient();
+        if (m_orderedOutput)
+            releaseOrderedOutput();
         finishBuild(2);
     }
 
     QMetaObject::invokeMethod(this, "startProcesses", Qt::QueuedConnection);
 }
 
+/**
+ * Aborts the build, because the executor could not start a command of its
+ * target. A separate jom process would exit with code 2 in this case.
+ */
+void TargetExecutor::onChildError(CommandExecutor *executor, const QString &message)
+{
+    if (m_forwardOutput)
+        forwardOutput(executor);
+    writeError("Error: " + message.toLocal8Bit() + '\n');
+    m_bAborted = true;
+    m_depgraph->clear();
+    m_pendingTargets.clear();
+    waitForProcesses();
+    waitForJobClient();
+    if (m_orderedOutput)
+        releaseOrderedOutput();
+    finishBuild(2);
+}
+
+/**
+ * Writes the resources that were consumed while building the executor's target
+ * as one line of JSON to the resource report file.
+ */
+void TargetExecutor::writeResourceReport(CommandExecutor *executor, bool commandFailed)
+{
+    const DescriptionBlock *target = executor->target();
+    const ProcessResourceUsage &usage = executor->resourceUsage();
+    QJsonObject obj;
+    obj.insert(QLatin1String("target"), target->targetName());
+    obj.insert(QLatin1String("makefile"), QDir::toNativeSeparators(target->makefile()->fileName()));
+    obj.insert(QLatin1String("failed"), commandFailed);
+    obj.insert(QLatin1String("processes"), executor->processCount());
+    obj.insert(QLatin1String("wallTime"), double(usage.wallTime));
+    obj.insert(QLatin1String("userTime"), double(usage.userTime));
+    obj.insert(QLatin1String("kernelTime"), double(usage.kernelTime));
+    obj.insert(QLatin1String("peakMemory"), double(usage.peakMemory));
+    obj.insert(QLatin1String("readBytes"), double(usage.readBytes));
+    obj.insert(QLatin1String("writeBytes"), double(usage.writeBytes));
+    m_resourceReport->write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+    m_resourceReport->write("\n");
+    m_resourceReport->flush();
+}
+
+/**
+ * Builds the dependency graph for target. If that fails, e.g. because a
+ * dependent does not exist, the build is aborted with exit code 2 and false
+ * is returned.
+ */
+bool TargetExecutor::buildDependencyGraph(DescriptionBlock *target)
+{
+    try {
+        m_depgraph->build(target);
+    } catch (const Exception &e) {
+        m_bAborted = true;
+        m_depgraph->clear();
+        m_pendingTargets.clear();
+        writeError("Error: " + e.message().toLocal8Bit() + '\n');
+        // The caller might not be ready for the finished signal yet.
+        QMetaObject::invokeMethod(this, "finishBuild", Qt::QueuedConnection, Q_ARG(int, 2));
+        return false;
+    }
+    m_outputOrder = m_depgraph->buildOrder();
+    m_outputOrderPos = 0;
+    return true;
+}
+
+/**
+ * Takes the captured output of the executor's target and keeps it until
+ * releaseOrderedOutput() prints it.
+ *
+ * The memory that is used by held output is limited by /OUTPUTBUFFERLIMIT.
+ * If the limit is exceeded, held output is moved to temporary files.
+ */
+void TargetExecutor::holdOrderedOutput(CommandExecutor *executor)
+{
+    OutputBuffer *output = new OutputBuffer;
+    executor->takeCapturedOutput(*output);
+    if (output->isEmpty()) {
+        delete output;
+        return;
+    }
+
+    m_heldOutput.insert(executor->target(), output);
+    m_heldOutputMemorySize += output->memorySize();
+
+    const qint64 limit = qint64(m_makefile->options()->outputBufferLimit) * 1024 * 1024;
+    QHash<DescriptionBlock*, OutputBuffer*>::const_iterator it = m_heldOutput.constBegin();
+    for (; m_heldOutputMemorySize > limit && it != m_heldOutput.constEnd(); ++it) {
+        OutputBuffer *buffer = it.value();
+        const qint64 memorySize = buffer->memorySize();
+        if (memorySize > 0 && buffer->spillToDisk())
+            m_heldOutputMemorySize -= memorySize;
+    }
+}
+
+static void printOutput(const OutputBuffer &output)
+{
+    ConsoleWriter *writer = ConsoleWriter::instance();
+    output.forEachChunk([writer](OutputBuffer::Channel channel, const char *data, int length) {
+        FILE *stream = (channel == OutputBuffer::StdOut) ? stdout : stderr;
+        writer->write(stream, QByteArray(data, length));
+    });
+}
+
+/**
+ * Prints the held output in the order of the dependency graph's depth-first
+ * traversal. The output of a target is printed as soon as all targets that
+ * precede it in this order are finished or have been found up-to-date.
+ * That way the output doesn't depend on the number of jobs or the timing
+ * of the commands.
+ */
+void TargetExecutor::releaseOrderedOutput()
+{
+    while (m_outputOrderPos < m_outputOrder.count()) {
+        DescriptionBlock *target = m_outputOrder.at(m_outputOrderPos);
+        OutputBuffer *output = m_heldOutput.take(target);
+        if (output) {
+            m_heldOutputMemorySize -= output->memorySize();
+            printOutput(*output);
+            delete output;
+        } else if (m_depgraph->contains(target)) {
+            // Not finished yet.
+            break;
+        }
+        ++m_outputOrderPos;
+    }
+}
+
+/**
+ * Emits the captured output of the executor's target. Used by nested builds,
+ * whose output is written by the command executor that runs the nested build.
+ */
+void TargetExecutor::forwardOutput(CommandExecutor *executor)
+{
+    OutputBuffer output;
+    executor->takeCapturedOutput(output);
+    output.forEachChunk([this](OutputBuffer::Channel channel, const char *data, int length) {
+        const QByteArray chunk(data, length);
+        if (channel == OutputBuffer::StdOut)
+            emit standardOutput(chunk);
+        else
+            emit standardError(chunk);
+    });
+}
+
+/**
+ * Writes an error message of the build to the console or forwards it,
+ * if output forwarding is enabled.
+ */
+void TargetExecutor::writeError(const QByteArray &message)
+{
+    if (m_forwardOutput)
+        emit standardError(message);
+    else
+        ConsoleWriter::instance()->write(stderr, message, ConsoleWriter::TextMode);
+}
+
+CommandExecutor *TargetExecutor::createExecutor()
+{
+    CommandExecutor* executor = new CommandExecutor(this, &m_sharedEnvironment);
+    connect(executor, SIGNAL(finished(CommandExecutor*, bool)),
+            this, SLOT(onChildFinished(CommandExecutor*, bool)));
+    connect(executor, SIGNAL(error(CommandExecutor*, QString)),
+            this, SLOT(onChildError(CommandExecutor*, QString)));
+    executor->setOutputMemoryLimit(qint64(m_makefile->options()->outputBufferLimit) * 1024 * 1024);
+
+    if (!m_logDirectory.isEmpty()) {
+        executor->setLogDirectory(m_logDirectory);
+        m_processes.append(executor);
+        return executor;
+    }
+
+    if (m_orderedOutput || m_forwardOutput) {
+        executor->setOutputCapture(true);
+        m_processes.append(executor);
+        return executor;
+    }
+
+    if (m_makefile->options()->lineOutput) {
+        executor->setLineOutput(true);
+        m_processes.append(executor);
+        return executor;
+    }
+
+    // Exactly one executor writes its output directly to the console.
+    bool unbufferedExecutorFound = false;
+    foreach (CommandExecutor *other, m_processes) {
+        if (!other->isBufferedOutputSet()) {
+            unbufferedExecutorFound = true;
+            break;
+        }
+    }
+    if (!unbufferedExecutorFound)
+        executor->setBufferedOutput(false);
+
+    m_processes.append(executor);
+    return executor;
+}
+
+bool TargetExecutor::isExecutorAvailable() const
+{
+    return !m_availableProcesses.isEmpty() || m_processes.count() < m_maxNumberOfJobs;
+}
+
+/**
+ * Deletes the executors that have been idle since the idle timer was started.
+ * One executor is kept to serve the next target.
+ */
+void TargetExecutor::releaseIdleExecutors()
+{
+    if (m_bAborted)
+        return;
+
+    foreach (CommandExecutor *executor, m_availableProcesses) {
+        if (m_availableProcesses.count() <= 1)
+            break;
+        if (!executor->isBufferedOutputSet())
+            continue;
+        m_availableProcesses.removeOne(executor);
+        m_processes.removeOne(executor);
+        delete executor;
+    }
+}
+
 int TargetExecutor::numberOfRunningProcesses() const
 {
     return m_processes.count() - m_availableProcesses.count();
@@ -29,6 +29,8 @@
 #include "makefile.h"
 #include <QObject>
 #include <QEvent>
+#include <QTimer>
+#include <QtCore/QHash>
 #include <QtCore/QMap>
 
 QT_BEGIN_NAMESPACE
@@ -40,6 +42,8 @@ namespace NMakeFile {
 class CommandExecutor;
 class DependencyGraph;
 class JobClient;
+class OutputBuffer;
+class SubMakefiles;
 
 class TargetExecutor : public QObject {
     Q_OBJECT
@@ -49,32 +53,59 @@ public:
 
     void apply(Makefile* mkfile, const QStringList& targets);
     void removeTempFiles();
+    void setOutputForwardingEnabled(bool enabled) { m_forwardOutput = enabled; }
 
 signals:
     void finished(int exitCode);
+    void standardOutput(const QByteArray &data);
+    void standardError(const QByteArray &data);
 
 private slots:
     void startProcesses();
     void buildNextTarget();
     void onChildFinished(CommandExecutor*, bool commandFailed);
+    void onChildError(CommandExecutor *executor, const QString &message);
+    void releaseIdleExecutors();
+    void finishBuild(int exitCode);
 
 private:
+    CommandExecutor *createExecutor();
+    bool isExecutorAvailable() const;
     int numberOfRunningProcesses() const;
     void waitForProcesses();
     void waitForJobClient();
-    void finishBuild(int exitCode);
     void findNextTarget();
+    int remainingBatchWindowTime() const;
+    void writeResourceReport(CommandExecutor *executor, bool commandFailed);
+    bool buildDependencyGraph(DescriptionBlock *target);
+    void holdOrderedOutput(CommandExecutor *executor);
+    void releaseOrderedOutput();
+    void forwardOutput(CommandExecutor *executor);
+    void writeError(const QByteArray &message);
 
 private:
     ProcessEnvironment m_environment;
+    SharedProcessEnvironment m_sharedEnvironment;
     Makefile* m_makefile;
     DependencyGraph* m_depgraph;
+    SubMakefiles *m_subMakefiles;
     QList<DescriptionBlock*> m_pendingTargets;
     JobClient *m_jobClient;
+    QFile *m_resourceReport;
+    QString m_logDirectory;
+    bool m_orderedOutput;
+    bool m_forwardOutput;
+    int m_maxNumberOfJobs;
+    QList<DescriptionBlock*> m_outputOrder;
+    int m_outputOrderPos;
+    QHash<DescriptionBlock*, OutputBuffer*> m_heldOutput;
+    qint64 m_heldOutputMemorySize;
     bool m_bAborted;
     int m_jobAcquisitionCount;
     QList<CommandExecutor*> m_availableProcesses;
     QList<CommandExecutor*> m_processes;
+    QTimer m_idleTimer;
+    QTimer m_batchWindowTimer;
     DescriptionBlock *m_nextTarget;
     bool m_allCommandsSuccessfullyExecuted;
 };
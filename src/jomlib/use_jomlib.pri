@@ -16,5 +16,6 @@ build_pass:CONFIG(release, debug|release) {
 }
 
 LIBS += $$JOMLIB
+win32:LIBS += -lpsapi
 POST_TARGETDEPS += $$JOMLIB
 unset(JOMLIB)
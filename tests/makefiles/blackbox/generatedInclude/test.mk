@@ -0,0 +1,9 @@
+# Test for makefiles that generate an include file in a preprocessor expression.
+# The include file must be read after the shell command has run.
+
+!IF [echo GENERATED = new> generated.mk]
+!ENDIF
+!INCLUDE generated.mk
+
+all:
+    @echo $(GENERATED)
@@ -0,0 +1,2 @@
+app_out: lib1
+    @echo app
@@ -0,0 +1,2 @@
+app2_out:
+    @echo app2
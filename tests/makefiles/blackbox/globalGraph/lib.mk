@@ -0,0 +1,7 @@
+lib_all: lib1 lib2
+
+lib1:
+    @echo lib1
+
+lib2:
+    @echo lib2
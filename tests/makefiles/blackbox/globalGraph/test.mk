@@ -0,0 +1,27 @@
+# Test for the /GLOBALGRAPH option.
+# app_out of app.mk depends on lib1 of lib.mk. Without the global graph,
+# the recursive call of app.mk would not know how to build lib1.
+
+all: app lib
+
+app:
+    @$(MAKE) /f app.mk
+
+lib:
+    @$(MAKE) /f lib.mk
+
+# Both calls of lib.mk share one parsed makefile. lib1 is built only once.
+shared: shared_a shared_b
+
+shared_a:
+    @$(MAKE) /f lib.mk lib1
+
+shared_b:
+    @$(MAKE) /f lib.mk lib_all
+
+# app2.mk has no target that depends on a target of lib.mk. Its targets
+# wait for the whole sub-make of lib.mk instead.
+gated: app2
+
+app2: lib
+    @$(MAKE) /f app2.mk
@@ -0,0 +1,8 @@
+first:
+    @echo nested
+
+failing:
+    @cmd /c exit 3
+
+missingDependent: doesNotExist.txt
+    @echo unreachable
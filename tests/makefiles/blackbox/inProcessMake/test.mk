@@ -0,0 +1,22 @@
+# Test for the /INPROCESSMAKE option.
+# The recursive call of jom runs inside the calling jom process and
+# doesn't show up as process in the resource report.
+
+all: nested
+    @echo all
+
+nested:
+    @$(MAKE) /f nested.mk
+
+failing:
+    @$(MAKE) /f nested.mk failing
+
+# A nested build with a missing dependent only fails its own command.
+# With /K the calling build continues with the other targets.
+missing: missingNested other
+
+missingNested:
+    @$(MAKE) /f nested.mk missingDependent
+
+other:
+    @echo other
@@ -5,7 +5,7 @@
 all:
 	@echo Please specify a target.
 
-tests: test_basic test_fileRemoval test_keepFile test_multipleFiles test_escaping
+tests: test_basic test_fileRemoval test_keepFile test_multipleFiles test_escaping test_reuseNamedFile
 
 init:
 	@if exist output rmdir /s /q output
@@ -54,3 +54,10 @@ test_escaping: init
 InRoot$$$$Sections
 # This line should be there.
 <<
+
+test_reuseNamedFile: init
+	type <<output\reused.txt >nul
+reused file
+<<
+	copy output\reused.txt output\test_reuseNamedFile.txt
+	echo @if exist output\reused.txt exit /b 1 >> output\post_check.cmd
@@ -0,0 +1,12 @@
+# Test for the /LINEOUTPUT option.
+# Every output line is prefixed with the name of the target that produced it.
+
+all: one two
+
+one:
+    @echo one line 1
+    @echo one line 2
+
+two:
+    @echo two line 1
+    @echo two line 2 1>&2
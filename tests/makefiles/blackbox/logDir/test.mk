@@ -0,0 +1,18 @@
+# Test for the /LOGDIR option.
+# The output of every target is written to a log file.
+# Only the output of the failing target is printed.
+
+all: succeeding sub\collision sub_collision failing
+
+succeeding:
+    @echo succeeding output
+
+sub\collision:
+    @echo first colliding output
+
+sub_collision:
+    @echo second colliding output
+
+failing:
+    @echo failing output
+    @cmd /c exit 1
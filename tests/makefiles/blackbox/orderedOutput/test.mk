@@ -0,0 +1,16 @@
+# Test for the /ORDEREDOUTPUT option.
+# The output of "slow" is printed before the output of "fast",
+# although "fast" finishes first.
+
+all: slow fast
+    @echo all
+
+slow: slow_dependency
+    @ping 127.0.0.1 -n 2 -w 1000 > nul
+    @echo slow
+
+slow_dependency:
+    @echo slow_dependency
+
+fast:
+    @echo fast
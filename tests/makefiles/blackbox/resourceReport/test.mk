@@ -0,0 +1,11 @@
+# Test for the /RESOURCEREPORT option.
+# Every target that runs commands gets one line in the report.
+
+all: one two
+
+one:
+    @cmd /c exit 0
+
+two:
+    @cmd /c exit 0
+    @cmd /c exit 0
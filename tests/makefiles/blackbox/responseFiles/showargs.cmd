@@ -0,0 +1,11 @@
+@echo off
+rem Prints how the arguments were received.
+set FIRST=%~1
+if "%FIRST:~0,1%"=="@" (
+    echo response file:
+    type "%FIRST:~1%"
+    echo.
+) else (
+    echo command line:
+    echo %*
+)
@@ -0,0 +1,10 @@
+# Test for the /MAXCMDLINE option.
+# The arguments of command lines that are longer than the limit are moved
+# into a response file, because showargs.cmd is listed in .RESPONSEFILES.
+
+.RESPONSEFILES: showargs.cmd
+
+ARGS=first_argument second_argument third_argument fourth_argument
+
+all:
+    @showargs.cmd $(ARGS)
@@ -121,5 +121,13 @@ TEST13=true
 TEST13=false
 !endif
 
+# Lines in skipped branches are not macro expanded.
+TEST14=false
+!if 0
+TEST14=$(UNCLOSED
+!else
+TEST14=true
+!endif
+
 all:
 
@@ -29,3 +29,5 @@ preciousness_three:
 
 $(NOT_DEFINED).SUFFIXES: .exe .obj
 suffixes:
+
+$(NOT_DEFINED).RESPONSEFILES: mytool C:\tools\OtherTool.exe
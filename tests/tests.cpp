@@ -27,21 +27,32 @@
 
 #include <QDebug>
 #include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
 #include <QHash>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QScopedPointer>
 #include <QStringBuilder>
+#include <QTemporaryDir>
 #include <QTest>
 
 #include <ppexprparser.h>
 #include <makefilefactory.h>
+#include <makefilelinereader.h>
 #include <preprocessor.h>
 #include <parser.h>
 #include <options.h>
+#include <outputbuffer.h>
+#include <consolewriter.h>
 #include <exception.h>
+#include <linetokenizer.h>
+#include <includeprefetcher.h>
 
 #include <algorithm>
 #include <functional>
 #include <limits>
+#include <numeric>
 
 using namespace NMakeFile;
 
@@ -108,6 +119,50 @@ void Tests::includeCycle()
     QVERIFY(bExceptionCaught);
 }
 
+void Tests::includePrefetcher()
+{
+    const auto readContent = [](const QString &fileName) {
+        QFile file(fileName);
+        return file.open(QFile::ReadOnly)
+                ? MakefileLineReader::decodeContent(file.readAll()) : QString();
+    };
+
+    const QString content = readContent("include_test.mk");
+    QCOMPARE(IncludePrefetcher::literalIncludeFiles(content),
+             QStringList() << "include2.mk" << "include3.mk" << "subdir\\include4.mk"
+                           << "include9.mk");
+
+    // Files that were not prefetched are left to the caller.
+    // Taking them prefetches their literal includes.
+    IncludePrefetcher prefetcher;
+    const QString fileName = QFileInfo("include_test.mk").absoluteFilePath();
+    const QString includedFileName = QFileInfo("include2.mk").absoluteFilePath();
+    QVERIFY(prefetcher.take(fileName).isNull());
+    prefetcher.waitForDone();
+    QCOMPARE(prefetcher.take(includedFileName), readContent(includedFileName));
+
+    // Files are prefetched once. Taking them again leaves the reading to the caller.
+    prefetcher.prefetch(includedFileName);
+    QVERIFY(prefetcher.take(includedFileName).isNull());
+
+    QVERIFY(prefetcher.take(QFileInfo("nonexistent.mk").absoluteFilePath()).isNull());
+
+    // Files that were modified after they had been prefetched are not handed out.
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    QFile generatedFile(tempDir.path() + "/generated.mk");
+    QVERIFY(generatedFile.open(QFile::WriteOnly));
+    generatedFile.write("GENERATED = old\n");
+    generatedFile.close();
+    const QString generatedFileName = QFileInfo(generatedFile).absoluteFilePath();
+    prefetcher.prefetch(generatedFileName);
+    prefetcher.waitForDone();
+    QVERIFY(generatedFile.open(QFile::WriteOnly | QFile::Truncate));
+    generatedFile.write("GENERATED = regenerated\n");
+    generatedFile.close();
+    QVERIFY(prefetcher.take(generatedFileName).isNull());
+}
+
 void Tests::macros()
 {
     MacroTable macroTable;
@@ -336,6 +391,7 @@ void Tests::conditionals()
     QCOMPARE(macroTable->macroValue("TEST11"), QLatin1String("true"));
     QCOMPARE(macroTable->macroValue("TEST12"), QLatin1String("true"));
     QCOMPARE(macroTable->macroValue("TEST13"), QLatin1String("true"));
+    QCOMPARE(macroTable->macroValue("TEST14"), QLatin1String("true"));
 }
 
 void Tests::dotDirectives()
@@ -387,6 +443,13 @@ void Tests::dotDirectives()
     QCOMPARE(mkfile->preciousTargets().at(0), QLatin1String("preciousness_one"));
     QCOMPARE(mkfile->preciousTargets().at(1), QLatin1String("preciousness_two"));
     QCOMPARE(mkfile->preciousTargets().at(2), QLatin1String("preciousness_three"));
+
+    QCOMPARE(mkfile->responseFileTools(), QStringList() << "mytool" << "othertool");
+    QVERIFY(mkfile->acceptsResponseFile(QLatin1String("mytool")));
+    QVERIFY(mkfile->acceptsResponseFile(QLatin1String("D:\\bin\\othertool.exe")));
+    QVERIFY(mkfile->acceptsResponseFile(QLatin1String("CL.EXE")));
+    QVERIFY(mkfile->acceptsResponseFile(QLatin1String("C:/VC/bin/link.exe")));
+    QVERIFY(!mkfile->acceptsResponseFile(QLatin1String("cmd")));
 }
 
 void Tests::descriptionBlocks()
@@ -523,9 +586,113 @@ void Tests::inferenceRules()
         QVERIFY(!QFile::exists(fileToCreate));
     }
     QCOMPARE(target->m_commands.count(), 1);
+    target->expandFileNameMacros();
     QCOMPARE(target->m_commands.first().m_commandLine, expectedCommandLine);
 }
 
+void Tests::sharedInferenceRuleCommands()
+{
+    QVERIFY(openMakefile(QLatin1String("infrules.mk")));
+    QScopedPointer<Makefile> mkfile(m_makefileFactory->makefile());
+    QVERIFY(mkfile);
+    DescriptionBlock *foo1 = mkfile->target("foo1.obj");
+    DescriptionBlock *foo2 = mkfile->target("foo2.obj");
+    QVERIFY(foo1);
+    QVERIFY(foo2);
+    mkfile->applyInferenceRules(QList<DescriptionBlock*>() << foo1 << foo2);
+    QCOMPARE(foo1->m_commands.count(), 1);
+    QCOMPARE(foo2->m_commands.count(), 1);
+
+    // Both targets share the commands of the inference rule until they are dispatched.
+    const DescriptionBlock *constFoo1 = foo1;
+    const DescriptionBlock *constFoo2 = foo2;
+    QCOMPARE(&constFoo1->m_commands.at(0), &constFoo2->m_commands.at(0));
+
+    foo1->expandFileNameMacros();
+    QVERIFY(&constFoo1->m_commands.at(0) != &constFoo2->m_commands.at(0));
+    QCOMPARE(foo1->m_commands.first().m_commandLine, QString("echo {subdir}.cpp.obj (subdir\\foo1.cpp)"));
+    foo2->expandFileNameMacros();
+    QCOMPARE(foo2->m_commands.first().m_commandLine, QString("echo {subdir}.cpp.obj (subdir\\foo2.cpp)"));
+}
+
+void Tests::batchSizes()
+{
+    // One job builds everything in one batch.
+    QCOMPARE(Makefile::batchSizes(QVector<qint64>(10, 1000), 1), QVector<int>() << 10);
+
+    // Batches get smaller towards the end.
+    QVector<int> sizes = Makefile::batchSizes(QVector<qint64>(100, 1000), 4);
+    QCOMPARE(std::accumulate(sizes.begin(), sizes.end(), 0), 100);
+    QVERIFY(sizes.count() > 4);
+    QCOMPARE(sizes.first(), 25);
+    QVERIFY(std::is_sorted(sizes.begin(), sizes.end(), std::greater<int>()));
+
+    // A huge file gets a batch of its own.
+    QVector<qint64> costs(20, 1000);
+    costs[0] = 1000000;
+    sizes = Makefile::batchSizes(costs, 4);
+    QCOMPARE(sizes.first(), 1);
+    QCOMPARE(std::accumulate(sizes.begin(), sizes.end(), 0), 20);
+
+    QVERIFY(Makefile::batchSizes(QVector<qint64>(), 4).isEmpty());
+}
+
+void Tests::batchConstruction_data()
+{
+    QTest::addColumn<int>("fileCount");
+    QTest::newRow("500") << 500;
+    QTest::newRow("1000") << 1000;
+    QTest::newRow("5000") << 5000;
+}
+
+void Tests::batchConstruction()
+{
+    QFETCH(int, fileCount);
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+
+    QByteArray content = ".cpp.obj::\n\t@echo $<\n\nall:";
+    for (int i = 0; i < fileCount; ++i) {
+        const QByteArray baseName = "f" + QByteArray::number(i);
+        content += " " + baseName + ".obj";
+        QFile sourceFile(tempDir.path() + "/" + baseName + ".cpp");
+        QVERIFY(sourceFile.open(QFile::WriteOnly));
+    }
+    content += "\n";
+    QFile makefile(tempDir.path() + "/batch.mk");
+    QVERIFY(makefile.open(QFile::WriteOnly));
+    makefile.write(content);
+    makefile.close();
+
+    const QString oldCurrentPath = QDir::currentPath();
+    QDir::setCurrent(tempDir.path());
+    QScopedPointer<Makefile> mkfile;
+    if (openMakefile(QLatin1String("batch.mk")))
+        mkfile.reset(m_makefileFactory->makefile());
+    QList<DescriptionBlock*> targets;
+    if (mkfile) {
+        foreach (const QString &dependent, mkfile->firstTarget()->m_dependents) {
+            if (DescriptionBlock *target = mkfile->target(dependent))
+                targets.append(target);
+        }
+        QBENCHMARK_ONCE {
+            mkfile->applyInferenceRules(targets);
+        }
+    }
+    QDir::setCurrent(oldCurrentPath);
+    QVERIFY(mkfile);
+    QCOMPARE(targets.count(), fileCount);
+
+    // Every source file is compiled exactly once.
+    int compiledFiles = 0;
+    foreach (DescriptionBlock *target, targets) {
+        QVERIFY(target->m_inferenceRules.isEmpty());
+        if (!target->m_commands.isEmpty())
+            compiledFiles += target->m_dependents.count();
+    }
+    QCOMPARE(compiledFiles, fileCount);
+}
+
 void Tests::cycleInTargets()
 {
     MacroTable *macroTable = new MacroTable;
@@ -546,6 +713,40 @@ void Tests::cycleInTargets()
     QVERIFY(exceptionThrown);
 }
 
+void Tests::dependentTargets()
+{
+    Makefile makefile("test.mk");
+    const auto createTarget = [&makefile](const QString &name) {
+        DescriptionBlock *target = new DescriptionBlock(&makefile);
+        target->setTargetName(name);
+        makefile.append(target);
+        return target;
+    };
+
+    DescriptionBlock *a = createTarget("a");
+    DescriptionBlock *b = createTarget("B");
+    a->m_dependents << "b" << "c";
+    QCOMPARE(a->dependentTargets(), QVector<DescriptionBlock *>() << b << static_cast<DescriptionBlock *>(0));
+
+    // New targets of the makefile are picked up.
+    DescriptionBlock *c = createTarget("c");
+    QCOMPARE(a->dependentTargets(), QVector<DescriptionBlock *>() << b << c);
+
+    // Dependents can be appended and restored.
+    const QStringList savedDependents = a->m_dependents;
+    a->m_dependents << "a";
+    QCOMPARE(a->dependentTargets(), QVector<DescriptionBlock *>() << b << c << a);
+    a->m_dependents = savedDependents;
+    QCOMPARE(a->dependentTargets(), QVector<DescriptionBlock *>() << b << c);
+
+    // Other changes must invalidate the resolved targets.
+    a->m_dependents[0] = "a";
+    a->invalidateDependentTargets();
+    QCOMPARE(a->dependentTargets(), QVector<DescriptionBlock *>() << a << c);
+
+    makefile.clear();
+}
+
 void Tests::dependentsWithSpace()
 {
     QVERIFY( openMakefile(QLatin1String("depswithspace.mk")) );
@@ -930,6 +1131,278 @@ void Tests::windowsPathsInTargetName()
     QCOMPARE(target->m_commands.count(), 2);
 }
 
+static void writeTextFile(const QString &fileName, const QByteArray &content)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write(content);
+}
+
+static QStringList makefileSummary(const Makefile *mkfile)
+{
+    QStringList result;
+    foreach (const DescriptionBlock *target, mkfile->targets()) {
+        QString str = target->targetName() + ": " + target->m_dependents.join(QLatin1Char(' '));
+        foreach (const Command &cmd, target->m_commands) {
+            str += "\n\t" + cmd.m_commandLine;
+            foreach (const InlineFile *inlineFile, cmd.m_inlineFiles)
+                str += "\n<<" + inlineFile->m_filename + ':' + inlineFile->m_content;
+        }
+        str += "\nrules: " + QString::number(target->m_inferenceRules.count());
+        result.append(str);
+    }
+    foreach (const InferenceRule *rule, mkfile->inferenceRules()) {
+        result.append(rule->m_fromExtension + rule->m_toExtension + ' '
+                      + QString::number(rule->m_priority));
+    }
+    result.sort();
+    result.append(mkfile->firstTarget()->targetName());
+    result.append(mkfile->macroTable()->macroValue("VALUE"));
+    return result;
+}
+
+void Tests::parseCache()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString cacheDir = tempDir.path() + "/cache";
+    QVERIFY(QDir(tempDir.path()).mkdir("sub"));
+    const QString makefileName = tempDir.path() + "/sub/test.mk";
+    writeTextFile(makefileName,
+                  "!INCLUDE include.mk\n"
+                  "all: foo.obj bar.exe\n"
+                  "\t@echo $(VALUE)\n"
+                  "\t@type <<inline.txt\n"
+                  "inline $(VALUE)\n"
+                  "<<KEEP\n"
+                  ".cpp.obj:\n"
+                  "\tcl /c $<\n");
+    writeTextFile(tempDir.path() + "/sub/include.mk", "VALUE=one\n");
+
+    // The include file is searched in the current directory first.
+    struct CurrentDirectoryRestorer
+    {
+        QString path;
+        ~CurrentDirectoryRestorer() { QDir::setCurrent(path); }
+    } currentDirectoryRestorer = { QDir::currentPath() };
+    QDir::setCurrent(tempDir.path());
+    const QStringList args = QStringList() << "/F" << makefileName << "/PARSECACHE" << cacheDir;
+
+    // first run: parse and store the snapshot
+    QVERIFY(m_makefileFactory->apply(args));
+    QVERIFY(!m_makefileFactory->makefileLoadedFromCache());
+    QScopedPointer<Makefile> mkfile(m_makefileFactory->makefile());
+    const QStringList parsedSummary = makefileSummary(mkfile.data());
+    QCOMPARE(parsedSummary.last(), QLatin1String("one"));
+    QCOMPARE(QDir(cacheDir).entryList(QDir::Files).count(), 1);
+
+    // second run: load the snapshot
+    QVERIFY(m_makefileFactory->apply(args));
+    QVERIFY(m_makefileFactory->makefileLoadedFromCache());
+    mkfile.reset(m_makefileFactory->makefile());
+    QCOMPARE(makefileSummary(mkfile.data()), parsedSummary);
+
+    // a changed include file invalidates the snapshot
+    writeTextFile(tempDir.path() + "/sub/include.mk", "VALUE=two\n");
+    QVERIFY(m_makefileFactory->apply(args));
+    QVERIFY(!m_makefileFactory->makefileLoadedFromCache());
+    mkfile.reset(m_makefileFactory->makefile());
+    QCOMPARE(makefileSummary(mkfile.data()).last(), QLatin1String("two"));
+    QVERIFY(m_makefileFactory->apply(args));
+    QVERIFY(m_makefileFactory->makefileLoadedFromCache());
+    mkfile.reset(m_makefileFactory->makefile());
+    QCOMPARE(makefileSummary(mkfile.data()).last(), QLatin1String("two"));
+
+    // an include file that takes precedence invalidates the snapshot
+    writeTextFile(tempDir.path() + "/include.mk", "VALUE=three\n");
+    QVERIFY(m_makefileFactory->apply(args));
+    QVERIFY(!m_makefileFactory->makefileLoadedFromCache());
+    mkfile.reset(m_makefileFactory->makefile());
+    QCOMPARE(makefileSummary(mkfile.data()).last(), QLatin1String("three"));
+
+    // a different command line macro uses a different snapshot
+    QVERIFY(m_makefileFactory->apply(QStringList(args) << "OTHER=1"));
+    QVERIFY(!m_makefileFactory->makefileLoadedFromCache());
+    mkfile.reset(m_makefileFactory->makefile());
+    QCOMPARE(QDir(cacheDir).entryList(QDir::Files).count(), 2);
+
+    // makefiles that depend on the file system are not cached
+    const QString uncacheableMakefileName = tempDir.path() + "/uncacheable.mk";
+    writeTextFile(uncacheableMakefileName,
+                  "!IF EXIST(sub\\include.mk)\n"
+                  "VALUE=exists\n"
+                  "!ENDIF\n"
+                  "all:\n"
+                  "\t@echo $(VALUE)\n");
+    const QStringList uncacheableArgs = QStringList()
+            << "/F" << uncacheableMakefileName << "/PARSECACHE" << cacheDir;
+    QVERIFY(m_makefileFactory->apply(uncacheableArgs));
+    mkfile.reset(m_makefileFactory->makefile());
+    QVERIFY(m_makefileFactory->apply(uncacheableArgs));
+    QVERIFY(!m_makefileFactory->makefileLoadedFromCache());
+    mkfile.reset(m_makefileFactory->makefile());
+    QCOMPARE(makefileSummary(mkfile.data()).last(), QLatin1String("exists"));
+    QCOMPARE(QDir(cacheDir).entryList(QDir::Files).count(), 2);
+}
+
+/**
+ * Tokenizes the line with the regular expressions that LineTokenizer replaces.
+ */
+static QString tokenizeWithRegExp(const QString &line)
+{
+    static const QRegExp rexDotDirective("^\\.(IGNORE|PRECIOUS|RESPONSEFILES|SILENT|SUFFIXES)\\s*:(.*)");
+    static const QRegExp rexInferenceRule("^(\\{.*\\})?(\\.\\w+)(\\{.*\\})?(\\.\\w+)(:{1,2})");
+    static const QRegExp rexPreprocessingDirective("^!\\s*(\\S+)(.*)");
+    static const QRegExp rexElseIf("^(ifn?def|if)\\s+(.*)$", Qt::CaseInsensitive);
+
+    QString result;
+    if (line.trimmed().isEmpty()) {
+        result = "empty";
+    } else if (QRegExp(rexDotDirective).exactMatch(line)) {
+        QRegExp rex(rexDotDirective);
+        rex.exactMatch(line);
+        result = "dot|" + rex.cap(1) + '|' + rex.cap(2);
+    } else if (QRegExp(rexInferenceRule).exactMatch(line)) {
+        QRegExp rex(rexInferenceRule);
+        rex.exactMatch(line);
+        QString fromPath = rex.cap(1);
+        QString toPath = rex.cap(3);
+        if (fromPath.length() >= 2)
+            fromPath = fromPath.mid(1, fromPath.length() - 2);
+        if (toPath.length() >= 2)
+            toPath = toPath.mid(1, toPath.length() - 2);
+        result = "rule|" + fromPath + '|' + rex.cap(2) + '|' + toPath + '|' + rex.cap(4)
+                + '|' + QString::number(rex.cap(5).length() > 1);
+    } else {
+        result = "other";
+    }
+
+    QRegExp rex(rexPreprocessingDirective);
+    if (rex.exactMatch(line)) {
+        QString directive = rex.cap(1).toUpper();
+        QString value = rex.cap(2).trimmed();
+        QRegExp rex2(rexElseIf);
+        if (directive == "ELSE" && rex2.exactMatch(value)) {
+            directive.append(rex2.cap(1).toUpper());
+            value = rex2.cap(2);
+        }
+        result += "|!" + directive + '|' + value;
+    }
+
+    result += "|split:" + line.split(QRegExp("\\s"), QString::SkipEmptyParts).join('/');
+    return result;
+}
+
+static QString tokenizeWithLineTokenizer(const QString &line)
+{
+    QString result;
+    LineTokenizer::Tokens tokens;
+    switch (LineTokenizer::classify(line, &tokens)) {
+    case LineTokenizer::EmptyLine:
+        result = "empty";
+        break;
+    case LineTokenizer::DotDirectiveLine:
+        result = "dot|" + tokens.directive + '|' + tokens.value;
+        break;
+    case LineTokenizer::InferenceRuleLine:
+        result = "rule|" + tokens.fromSearchPath + '|' + tokens.fromExtension + '|'
+                + tokens.toSearchPath + '|' + tokens.toExtension + '|'
+                + QString::number(tokens.batchMode);
+        break;
+    case LineTokenizer::OtherLine:
+        result = "other";
+        break;
+    }
+
+    QString directive, value;
+    if (LineTokenizer::isPreprocessingDirective(line, &directive, &value))
+        result += "|!" + directive + '|' + value;
+
+    result += "|split:" + LineTokenizer::splitAtWhiteSpace(line).join('/');
+    return result;
+}
+
+void Tests::lineTokenizer()
+{
+    QStringList lines = QStringList()
+            << "" << " \t " << "." << "{" << "!" << "! " << "!IF 1" << "!  ifdef  FOO  "
+            << "!else if 1 == 1" << "!ELSE IFDEF FOO" << "!else ifndef\tFOO" << "!else ifx"
+            << "!else if" << "!else" << ".SILENT:" << ".SILENT :" << ".SUFFIXES: .c .obj"
+            << ".SUFFIXESX:" << ".silent:" << ".PRECIOUS : a  b\tc" << ".IGNORE" << " .SILENT:"
+            << ".c.obj:" << ".c.obj::" << ".c.obj:::" << ".c.obj: " << ".c.obj" << ".c:"
+            << "{src}.c{obj}.obj::" << "{src\\}.c.obj:" << ".c{obj}.obj:" << "{}.c{}.obj:"
+            << "{a}.c}.d{b}.obj:" << "{a{b}.c{c}d}.obj:" << "{a}b.c.obj:" << QString::fromLatin1(".c_1.o\xE4:")
+            << "{ }.c.obj:" << "..obj:" << ".c..obj:" << "all: foo.obj" << "a b\tc  d ";
+
+    // All lines of the test makefiles.
+    QDirIterator it(QDir::currentPath(), QStringList("*.mk"), QDir::Files,
+                    QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        QFile file(it.next());
+        QVERIFY(file.open(QFile::ReadOnly));
+        foreach (const QByteArray &line, file.readAll().split('\n'))
+            lines.append(QString::fromLatin1(line).remove('\r'));
+    }
+    QVERIFY(lines.count() > 500);
+
+    foreach (const QString &line, lines)
+        QCOMPARE(tokenizeWithLineTokenizer(line), tokenizeWithRegExp(line));
+}
+
+void Tests::parserThroughput()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+
+    // A makefile like the ones that qmake generates.
+    QByteArray content =
+            "CC = cl\n"
+            "CXX = cl\n"
+            "CXXFLAGS = -nologo -Zc:wchar_t -FS -O2 -MD -W3 -w44456 -w44457 -w44458\n"
+            "INCPATH = -I. -I..\\include -I$(QTDIR)\\include\n"
+            ".SUFFIXES: .c .cpp .cc .cxx\n"
+            "{..\\src}.cpp{release\\}.obj::\n"
+            "\t$(CXX) -c $(CXXFLAGS) $(INCPATH) -Forelease\\ @<<\n"
+            "\t$<\n"
+            "<<\n\n"
+            "first: all\n"
+            "!IF \"$(CONFIG)\" == \"debug\"\n"
+            "CXXFLAGS = $(CXXFLAGS) -Zi\n"
+            "!ENDIF\n";
+    QByteArray objects;
+    for (int i = 0; i < 10000; ++i) {
+        const QByteArray n = QByteArray::number(i);
+        objects += " release\\obj" + n + ".obj";
+        content += "# Source file " + n + "\n"
+                   "release\\obj" + n + ".obj: ..\\src\\file" + n + ".cpp \\\n"
+                   "\t\t..\\include\\header" + n + ".h ..\\include\\common.h # dependencies\n"
+                   "\t$(CXX) -c $(CXXFLAGS) $(INCPATH) -Forelease\\ @<<\n"
+                   "..\\src\\file" + n + ".cpp\n"
+                   "<<\n\n";
+    }
+    content += "all:" + objects + "\n\techo done\n";
+    const QString fileName = tempDir.path() + "/large.mk";
+    QFile file(fileName);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write(content);
+    file.close();
+
+    QElapsedTimer timer;
+    timer.start();
+    bool parsed = false;
+    QBENCHMARK_ONCE {
+        parsed = openMakefile(fileName);
+    }
+    const qint64 elapsed = qMax(qint64(1), timer.elapsed());
+    QVERIFY(parsed);
+    QScopedPointer<Makefile> mkfile(m_makefileFactory->makefile());
+    QCOMPARE(mkfile->firstTarget()->m_dependents.count(), 1);
+    QVERIFY(mkfile->target("release\\obj9999.obj"));
+    const int lineCount = content.count('\n');
+    qDebug("%d lines in %lld ms, %.0f lines/s", lineCount, elapsed,
+           double(lineCount) * 1000 / elapsed);
+}
+
 /**
  * Note: this function clears the environment of m_jomProcess after every start.
  */
@@ -1043,6 +1516,273 @@ QList<QByteArray> Tests::splitOutput(const QByteArray &output)
     return result;
 }
 
+void Tests::outputBuffer()
+{
+    OutputBuffer buffer;
+    QVERIFY(buffer.isEmpty());
+
+    // Consecutive writes to the same channel are merged into one chunk.
+    buffer.append(OutputBuffer::StdOut, "Hello ", 6);
+    buffer.append(OutputBuffer::StdOut, "world", 5);
+    buffer.append(OutputBuffer::StdErr, "error", 5);
+    buffer.append(OutputBuffer::StdOut, "!", 1);
+
+    // Data that exceeds the block size is split into multiple chunks.
+    const QByteArray bigData(200 * 1024, 'x');
+    buffer.append(OutputBuffer::StdErr, bigData.constData(), bigData.size());
+    QCOMPARE(buffer.size(), qint64(17 + bigData.size()));
+
+    QList<OutputBuffer::Channel> channels;
+    QList<QByteArray> chunks;
+    buffer.forEachChunk([&](OutputBuffer::Channel channel, const char *data, int length) {
+        channels.append(channel);
+        chunks.append(QByteArray(data, length));
+    });
+    QVERIFY(chunks.count() >= 5);
+    QCOMPARE(channels.at(0), OutputBuffer::StdOut);
+    QCOMPARE(chunks.at(0), QByteArray("Hello world"));
+    QCOMPARE(channels.at(1), OutputBuffer::StdErr);
+    QCOMPARE(chunks.at(1), QByteArray("error"));
+    QCOMPARE(channels.at(2), OutputBuffer::StdOut);
+    QCOMPARE(chunks.at(2), QByteArray("!"));
+    QByteArray bigDataRead;
+    for (int i = 3; i < chunks.count(); ++i) {
+        QCOMPARE(channels.at(i), OutputBuffer::StdErr);
+        bigDataRead += chunks.at(i);
+    }
+    QCOMPARE(bigDataRead, bigData);
+
+    OutputBuffer other;
+    other.swap(buffer);
+    QVERIFY(buffer.isEmpty());
+    QCOMPARE(other.size(), qint64(17 + bigData.size()));
+    other.clear();
+    QVERIFY(other.isEmpty());
+}
+
+void Tests::outputBufferSpill()
+{
+    OutputBuffer buffer;
+    buffer.setMemoryLimit(100);
+    QByteArray expectedStdOut;
+    QByteArray expectedStdErr;
+    for (int i = 0; i < 50; ++i) {
+        const QByteArray line = "line " + QByteArray::number(i) + '\n';
+        if (i % 3) {
+            buffer.append(OutputBuffer::StdOut, line.constData(), line.size());
+            expectedStdOut += line;
+        } else {
+            buffer.append(OutputBuffer::StdErr, line.constData(), line.size());
+            expectedStdErr += line;
+        }
+    }
+    QVERIFY(buffer.hasSpilledToDisk());
+    QCOMPARE(buffer.size(), qint64(expectedStdOut.size() + expectedStdErr.size()));
+
+    QByteArray actualStdOut;
+    QByteArray actualStdErr;
+    auto collect = [&](OutputBuffer::Channel channel, const char *data, int length) {
+        if (channel == OutputBuffer::StdOut)
+            actualStdOut.append(data, length);
+        else
+            actualStdErr.append(data, length);
+    };
+    buffer.forEachChunk(collect);
+    QCOMPARE(actualStdOut, expectedStdOut);
+    QCOMPARE(actualStdErr, expectedStdErr);
+
+    // Moving the records that are still in memory to the disk keeps the order.
+    QVERIFY(buffer.memorySize() > 0);
+    QVERIFY(buffer.spillToDisk());
+    QCOMPARE(buffer.memorySize(), qint64(0));
+    QCOMPARE(buffer.size(), qint64(expectedStdOut.size() + expectedStdErr.size()));
+    actualStdOut.clear();
+    actualStdErr.clear();
+    buffer.forEachChunk(collect);
+    QCOMPARE(actualStdOut, expectedStdOut);
+    QCOMPARE(actualStdErr, expectedStdErr);
+
+    buffer.clear();
+    QVERIFY(!buffer.hasSpilledToDisk());
+    QVERIFY(buffer.isEmpty());
+}
+
+void Tests::consoleWriter()
+{
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString fileName = tempDir.path() + "/console.txt";
+    FILE *stream = fopen(QFile::encodeName(fileName).constData(), "wb");
+    QVERIFY(stream);
+
+    // Write much more than the queue can hold. The queue must never exceed its cap.
+    ConsoleWriter *writer = ConsoleWriter::instance();
+    const ConsoleWriter::Statistics oldStatistics = writer->statistics();
+    const QByteArray chunk(64 * 1024, 'x');
+    QByteArray expectedContent;
+    for (int i = 0; i < 200; ++i) {
+        const QByteArray data = QByteArray::number(i) + ':' + chunk + '\n';
+        writer->write(stream, data);
+        expectedContent += data;
+    }
+    writer->flush();
+    fclose(stream);
+
+    // Everything arrives in the order it was written.
+    QFile file(fileName);
+    QVERIFY(file.open(QFile::ReadOnly));
+    QCOMPARE(file.readAll(), expectedContent);
+
+    const ConsoleWriter::Statistics statistics = writer->statistics();
+    QCOMPARE(statistics.bytesWritten - oldStatistics.bytesWritten,
+             quint64(expectedContent.size()));
+    QVERIFY(statistics.peakQueueSize <= ConsoleWriter::MaxQueueSize);
+
+    // Enqueuing never blocks. Waiting for space afterwards keeps the queue
+    // within its cap plus the data enqueued in between.
+    stream = fopen(QFile::encodeName(fileName).constData(), "wb");
+    QVERIFY(stream);
+    expectedContent.clear();
+    for (int i = 0; i < 200; ++i) {
+        const QByteArray data = QByteArray::number(i) + ':' + chunk + '\n';
+        if (i % 2)
+            writer->write(stream, data);
+        else
+            writer->enqueue(stream, data);
+        writer->waitForSpace();
+        expectedContent += data;
+    }
+    writer->flush();
+    fclose(stream);
+
+    file.close();
+    QVERIFY(file.open(QFile::ReadOnly));
+    QCOMPARE(file.readAll(), expectedContent);
+    QVERIFY(writer->statistics().peakQueueSize <= ConsoleWriter::MaxQueueSize + chunk.size() + 16);
+}
+
+static QStringList readMakefileLines(const QString &fileName, bool memoryMapping)
+{
+    QStringList result;
+    MakefileLineReader reader(fileName);
+    reader.setMemoryMappingEnabled(memoryMapping);
+    if (!reader.open())
+        return result;
+    forever {
+        const MakefileLine line = reader.readLine(false);
+        if (line.content.isNull())
+            break;
+        result.append(QString::number(reader.lineNumber()) + QLatin1Char(':')
+                      + QString::number(int(line.continuation)) + QLatin1Char(':')
+                      + line.content);
+    }
+    return result;
+}
+
+static QByteArray encodeMakefile(const QString &content, const QString &encoding)
+{
+    if (encoding == QLatin1String("utf-8"))
+        return "\xEF\xBB\xBF" + content.toUtf8();
+    if (encoding == QLatin1String("utf-16"))
+        return "\xFF\xFE" + QByteArray(reinterpret_cast<const char *>(content.utf16()),
+                                        content.length() * 2);
+    return content.toLatin1();
+}
+
+void Tests::makefileLineReader_data()
+{
+    QTest::addColumn<QString>("encoding");
+    QTest::newRow("latin-1") << "latin-1";
+    QTest::newRow("utf-8") << "utf-8";
+    QTest::newRow("utf-16") << "utf-16";
+}
+
+void Tests::makefileLineReader()
+{
+    QFETCH(QString, encoding);
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+    const QString fileName = tempDir.path() + QLatin1String("/lines.mk");
+    QFile file(fileName);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write(encodeMakefile(QString::fromLatin1(
+                   "# comment\n"
+                   "all: one \\\n"
+                   "  two\r\n"
+                   "\techo ^\\\n"
+                   "\techo caret^\n"
+                   "\techo \\\\\n"
+                   "#another comment\r\n"
+                   "\n"
+                   "\xE4\xF6\xFC: no newline at the end"), encoding));
+    file.close();
+
+    // The memory mapped reader and the buffered reader return the same lines.
+    const QStringList expected = QStringList()
+            << "2:1:all: one "
+            << "3:0:  two"
+            << "4:0:\techo \\"
+            << "5:2:\techo caret"
+            << "6:0:\techo \\\\"
+            << "8:0:"
+            << QString::fromLatin1("9:0:\xE4\xF6\xFC: no newline at the end");
+    QCOMPARE(readMakefileLines(fileName, false), expected);
+    QCOMPARE(readMakefileLines(fileName, true), expected);
+}
+
+void Tests::makefileLineReaderThroughput_data()
+{
+    QTest::addColumn<QString>("encoding");
+    QTest::addColumn<bool>("memoryMapping");
+    QTest::newRow("latin-1 buffered") << "latin-1" << false;
+    QTest::newRow("latin-1 mapped") << "latin-1" << true;
+    QTest::newRow("utf-8 buffered") << "utf-8" << false;
+    QTest::newRow("utf-8 mapped") << "utf-8" << true;
+    QTest::newRow("utf-16 buffered") << "utf-16" << false;
+    QTest::newRow("utf-16 mapped") << "utf-16" << true;
+}
+
+void Tests::makefileLineReaderThroughput()
+{
+    QFETCH(QString, encoding);
+    QFETCH(bool, memoryMapping);
+    QTemporaryDir tempDir;
+    QVERIFY(tempDir.isValid());
+
+    QString content;
+    for (int i = 0; i < 100000; ++i) {
+        const QString n = QString::number(i);
+        content += QLatin1String("# Comment for object ") + n + QLatin1String("\r\n"
+                   "release\\obj") + n + QLatin1String(".obj: ..\\src\\file") + n
+                + QLatin1String(".cpp \\\r\n"
+                   "\t\t..\\include\\header") + n + QLatin1String(".h ..\\include\\common.h\r\n"
+                   "\t$(CXX) -c $(CXXFLAGS) $(INCPATH) -Forelease\\ @<<\r\n"
+                   "\t..\\src\\file") + n + QLatin1String(".cpp\r\n"
+                   "<<\r\n\r\n");
+    }
+    const QString fileName = tempDir.path() + QLatin1String("/large.mk");
+    QFile file(fileName);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write(encodeMakefile(content, encoding));
+    const qint64 fileSize = file.size();
+    file.close();
+    content.clear();
+
+    MakefileLineReader reader(fileName);
+    reader.setMemoryMappingEnabled(memoryMapping);
+    QVERIFY(reader.open());
+    QElapsedTimer timer;
+    timer.start();
+    int lineCount = 0;
+    while (!reader.readLine(false).content.isNull())
+        ++lineCount;
+    const qint64 elapsed = qMax(qint64(1), timer.elapsed());
+    QCOMPARE(lineCount, 600000);
+    QTest::setBenchmarkResult(qreal(fileSize) * 1000 / elapsed, QTest::BytesPerSecond);
+    qDebug("%s: %.1f MB/s", QTest::currentDataTag(),
+           double(fileSize) / (1024 * 1024) * 1000 / elapsed);
+}
+
 void Tests::buildUnrelatedTargetsOnError()
 {
     QVERIFY(runJom(QStringList() << "/f" << "test.mk" << "/nologo" << "/k",
@@ -1178,6 +1918,7 @@ void Tests::inlineFiles()
     QVERIFY(fileContentsEqual("blackbox/inlineFiles/test_basic_expected.txt", "blackbox/inlineFiles/output/test_basic.txt"));
     QVERIFY(fileContentsEqual("blackbox/inlineFiles/test_multipleFiles_expected.txt", "blackbox/inlineFiles/output/test_multipleFiles.txt"));
     QVERIFY(fileContentsEqual("blackbox/inlineFiles/test_escaping_expected.txt", "blackbox/inlineFiles/output/test_escaping.txt"));
+    QVERIFY(fileContentsEqual("blackbox/inlineFiles/test_reuseNamedFile_expected.txt", "blackbox/inlineFiles/output/test_reuseNamedFile.txt"));
     QVERIFY(runJom(QStringList() << "/f" << "test.mk" << "post_check", "blackbox/inlineFiles"));
     QCOMPARE(m_jomProcess->exitCode(), 0);
 }
@@ -1441,4 +2182,228 @@ void Tests::rulesBeingRun()
     QVERIFY(output.contains("All target executed"));
 }
 
+void Tests::resourceReport()
+{
+    const QString reportFileName = QLatin1String("blackbox/resourceReport/report.jsonl");
+    QFile::remove(reportFileName);
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/f" << "test.mk"
+                   << "/RESOURCEREPORT" << "report.jsonl", "blackbox/resourceReport"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+
+    QFile reportFile(reportFileName);
+    QVERIFY(reportFile.open(QFile::ReadOnly));
+    QHash<QString, QJsonObject> report;
+    foreach (const QByteArray &line, reportFile.readAll().split('\n')) {
+        if (line.isEmpty())
+            continue;
+        const QJsonObject obj = QJsonDocument::fromJson(line).object();
+        report.insert(obj.value(QLatin1String("target")).toString(), obj);
+    }
+    reportFile.close();
+    QFile::remove(reportFileName);
+
+    // Targets without commands don't show up in the report.
+    QCOMPARE(report.count(), 2);
+    QVERIFY(report.contains(QLatin1String("one")));
+    QVERIFY(report.contains(QLatin1String("two")));
+    QCOMPARE(report.value(QLatin1String("one")).value(QLatin1String("processes")).toInt(), 1);
+    QCOMPARE(report.value(QLatin1String("two")).value(QLatin1String("processes")).toInt(), 2);
+    foreach (const QJsonObject &obj, report) {
+        QCOMPARE(obj.value(QLatin1String("failed")).toBool(), false);
+        QVERIFY(obj.value(QLatin1String("wallTime")).toDouble() >= 0);
+        QVERIFY(obj.value(QLatin1String("peakMemory")).toDouble() > 0);
+    }
+}
+
+void Tests::lineOutput()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j2" << "/LINEOUTPUT" << "/f" << "test.mk",
+                   "blackbox/lineOutput"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QList<QByteArray> lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    std::sort(lines.begin(), lines.end());
+    QCOMPARE(lines.count(), 4);
+    QCOMPARE(lines.at(0), QByteArray("[one] one line 1"));
+    QCOMPARE(lines.at(1), QByteArray("[one] one line 2"));
+    QCOMPARE(lines.at(2), QByteArray("[two] two line 1"));
+    QCOMPARE(lines.at(3), QByteArray("[two] two line 2"));
+}
+
+void Tests::orderedOutput()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j4" << "/ORDEREDOUTPUT" << "/f" << "test.mk",
+                   "blackbox/orderedOutput"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QList<QByteArray> lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines, QList<QByteArray>() << "slow_dependency" << "slow" << "fast" << "all");
+}
+
+void Tests::logDir()
+{
+    QDir logDir(QLatin1String("blackbox/logDir/logs"));
+    logDir.removeRecursively();
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/k" << "/LOGDIR" << "logs"
+                   << "/f" << "test.mk", "blackbox/logDir"));
+    QVERIFY(m_jomProcess->exitCode() != 0);
+    const QByteArray output = m_jomProcess->readAllStandardOutput();
+    QVERIFY(output.contains("failing output"));
+    QVERIFY(!output.contains("succeeding output"));
+
+    QFile logFile(logDir.filePath(QLatin1String("succeeding.log")));
+    QVERIFY(logFile.open(QFile::ReadOnly));
+    QVERIFY(logFile.readAll().contains("succeeding output"));
+    logFile.close();
+    logFile.setFileName(logDir.filePath(QLatin1String("failing.log")));
+    QVERIFY(logFile.open(QFile::ReadOnly));
+    QVERIFY(logFile.readAll().contains("failing output"));
+    logFile.close();
+
+    // Targets whose names map to the same log file name get separate log files.
+    QByteArray collidingLogs;
+    logFile.setFileName(logDir.filePath(QLatin1String("sub_collision.log")));
+    QVERIFY(logFile.open(QFile::ReadOnly));
+    collidingLogs += logFile.readAll();
+    logFile.close();
+    logFile.setFileName(logDir.filePath(QLatin1String("sub_collision.2.log")));
+    QVERIFY(logFile.open(QFile::ReadOnly));
+    collidingLogs += logFile.readAll();
+    logFile.close();
+    QVERIFY(collidingLogs.contains("first colliding output"));
+    QVERIFY(collidingLogs.contains("second colliding output"));
+    logDir.removeRecursively();
+}
+
+void Tests::responseFiles()
+{
+    // Response files are not used by default.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/f" << "test.mk", "blackbox/responseFiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QList<QByteArray> lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines.count(), 2);
+    QCOMPARE(lines.at(0), QByteArray("command line:"));
+    QCOMPARE(lines.at(1), QByteArray("first_argument second_argument third_argument fourth_argument"));
+
+    // The tool receives @file if the command line is longer than the limit.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/MAXCMDLINE" << "40" << "/f" << "test.mk",
+                   "blackbox/responseFiles"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines.count(), 2);
+    QCOMPARE(lines.at(0), QByteArray("response file:"));
+    QCOMPARE(lines.at(1), QByteArray("first_argument second_argument third_argument fourth_argument"));
+}
+
+void Tests::inProcessMake()
+{
+    const QString reportFileName = QLatin1String("blackbox/inProcessMake/report.jsonl");
+    QFile::remove(reportFileName);
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j2" << "/INPROCESSMAKE" << "/f" << "test.mk"
+                   << "/RESOURCEREPORT" << "report.jsonl", "blackbox/inProcessMake"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QList<QByteArray> lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines, QList<QByteArray>() << "nested" << "all");
+
+    QFile reportFile(reportFileName);
+    QVERIFY(reportFile.open(QFile::ReadOnly));
+    QHash<QString, QJsonObject> report;
+    foreach (const QByteArray &line, reportFile.readAll().split('\n')) {
+        if (line.isEmpty())
+            continue;
+        const QJsonObject obj = QJsonDocument::fromJson(line).object();
+        report.insert(obj.value(QLatin1String("target")).toString(), obj);
+    }
+    reportFile.close();
+    QFile::remove(reportFileName);
+
+    // The nested jom didn't run in a separate process.
+    QVERIFY(report.contains(QLatin1String("nested")));
+    QCOMPARE(report.value(QLatin1String("nested")).value(QLatin1String("processes")).toInt(), 0);
+
+    // A failing nested build fails the command that started it.
+    QVERIFY(runJom(QStringList() << "/nologo" << "/INPROCESSMAKE" << "/f" << "test.mk"
+                   << "failing", "blackbox/inProcessMake"));
+    QCOMPARE(m_jomProcess->exitCode(), 2);
+    QVERIFY(m_jomProcess->readAllStandardOutput().contains("[failing] Error 3"));
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/K" << "/INPROCESSMAKE" << "/f" << "test.mk"
+                   << "missing", "blackbox/inProcessMake"));
+    QCOMPARE(m_jomProcess->exitCode(), 1);
+    lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    QVERIFY(lines.contains("Error: dependent 'doesNotExist.txt' does not exist."));
+    QVERIFY(std::find_if(lines.begin(), lines.end(), [] (const QByteArray &line)
+                { return line.endsWith("[missingNested] Error 2"); }) != lines.end());
+    QVERIFY(lines.contains("other"));
+    QVERIFY(!lines.contains("unreachable"));
+}
+
+void Tests::globalGraph()
+{
+    QVERIFY(runJom(QStringList() << "/nologo" << "/GLOBALGRAPH" << "/DUMPGRAPH" << "/f" << "test.mk",
+                   "blackbox/globalGraph"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QList<QByteArray> lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines, QList<QByteArray>() << "all" << "app" << "app.mk:app_out" << "lib.mk:lib1"
+                                        << "lib" << "lib.mk:lib_all" << "lib.mk:lib1"
+                                        << "lib.mk:lib2");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/j1" << "/GLOBALGRAPH" << "/f" << "test.mk",
+                   "blackbox/globalGraph"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines.count(), 3);
+    QVERIFY(lines.contains("lib2"));
+    QVERIFY(lines.indexOf("lib1") >= 0);
+    QVERIFY(lines.indexOf("lib1") < lines.indexOf("app"));
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/GLOBALGRAPH" << "/f" << "test.mk" << "shared",
+                   "blackbox/globalGraph"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines.count(), 2);
+    QVERIFY(lines.contains("lib1"));
+    QVERIFY(lines.contains("lib2"));
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/GLOBALGRAPH" << "/DUMPGRAPH" << "/f" << "test.mk"
+                                 << "gated", "blackbox/globalGraph"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines, QList<QByteArray>() << "gated" << "app2"
+                                        << "lib" << "lib.mk:lib_all" << "lib.mk:lib1" << "lib.mk:lib2"
+                                        << "app2.mk:app2_out"
+                                        << "lib" << "lib.mk:lib_all" << "lib.mk:lib1" << "lib.mk:lib2");
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/GLOBALGRAPH" << "/f" << "test.mk" << "gated",
+                   "blackbox/globalGraph"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines.count(), 3);
+    QCOMPARE(lines.last(), QByteArray("app2"));
+}
+
+void Tests::generatedInclude()
+{
+    // A stale file from a previous run must not be used.
+    QFile generatedFile("blackbox/generatedInclude/generated.mk");
+    QVERIFY(generatedFile.open(QFile::WriteOnly | QFile::Truncate));
+    generatedFile.write("GENERATED = old\n");
+    generatedFile.close();
+
+    QVERIFY(runJom(QStringList() << "/nologo" << "/f" << "test.mk", "blackbox/generatedInclude"));
+    QCOMPARE(m_jomProcess->exitCode(), 0);
+    QList<QByteArray> lines = splitOutput(m_jomProcess->readAllStandardOutput());
+    lines.removeAll(QByteArray());
+    QCOMPARE(lines, QList<QByteArray>() << "new");
+    QFile::remove("blackbox/generatedInclude/generated.mk");
+}
+
 QTEST_MAIN(Tests)
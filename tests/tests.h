@@ -41,6 +41,7 @@ private slots:
     // preprocessor tests
     void includeFiles();
     void includeCycle();
+    void includePrefetcher();
     void macros();
     void invalidMacros_data();
     void invalidMacros();
@@ -56,7 +57,12 @@ private slots:
     void descriptionBlocks();
     void inferenceRules_data();
     void inferenceRules();
+    void sharedInferenceRuleCommands();
+    void batchSizes();
+    void batchConstruction_data();
+    void batchConstruction();
     void cycleInTargets();
+    void dependentTargets();
     void dependentsWithSpace();
     void multipleTargets();
     void commandModifiers();
@@ -65,6 +71,20 @@ private slots:
     void fileNameMacrosInDependents();
     void wildcardsInDependencies();
     void windowsPathsInTargetName();
+    void parseCache();
+    void lineTokenizer();
+    void parserThroughput();
+
+    // output buffer tests
+    void outputBuffer();
+    void outputBufferSpill();
+    void consoleWriter();
+
+    // line reader tests
+    void makefileLineReader_data();
+    void makefileLineReader();
+    void makefileLineReaderThroughput_data();
+    void makefileLineReaderThroughput();
 
     // black-box tests
     void buildUnrelatedTargetsOnError();
@@ -89,6 +109,14 @@ private slots:
     void noTargets();
     void outOfDateCheck();
     void rulesBeingRun();
+    void resourceReport();
+    void lineOutput();
+    void logDir();
+    void responseFiles();
+    void orderedOutput();
+    void inProcessMake();
+    void globalGraph();
+    void generatedInclude();
 
 private:
     bool openMakefile(const QString& fileName);